@@ -0,0 +1,259 @@
+#include "batch.h"
+#include "batch_kernels.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// -------------------------------------------------------------------------------------------------
+
+// The number of rows every instruction processes at a time. Blocks of all stack levels of usual
+// expressions fit into L1 cache together.
+constexpr size_t kBlockRows = 256;
+
+// The number of rows in one task of the parallel evaluation. It is big enough to make the task
+// scheduling cost negligible and small enough to balance workers on uneven rows.
+constexpr size_t kChunkRows = 16 * kBlockRows;
+
+// -------------------------------------------------------------------------------------------------
+
+// Scratch memory of the batch evaluation. Every register has its own block of memory, every
+// constant of the constant pool has its block too, which is filled with the constant once, so
+// instructions take constant operands like registers. Variables are read straight from their
+// columns without copying.
+struct BatchScratch
+{
+    explicit BatchScratch(const calc::CompiledExpression& expression)
+        : registers(expression.registers())
+        , blocks((registers + expression.constants().size()) * kBlockRows)
+    {
+        const std::pmr::vector<double>& constants = expression.constants();
+        for (size_t index = 0; index < constants.size(); ++index)
+            std::fill_n(constant(index), kBlockRows, constants[index]);
+    }
+
+    double* block(size_t index)
+    {
+        return &blocks[index * kBlockRows];
+    }
+
+    double* constant(size_t index)
+    {
+        return block(registers + index);
+    }
+
+    size_t registers;
+    std::vector<double> blocks;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+calc::BatchResult all_rows_failed(calc::Error error, size_t rows, double* results)
+{
+    std::fill_n(results, rows, std::numeric_limits<double>::quiet_NaN());
+    return {rows, 0, error, false};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Checks that the expression can be evaluated with the given columns, fails all rows otherwise.
+bool check_batch(const calc::CompiledExpression& expression,
+                 size_t column_count,
+                 size_t rows,
+                 double* results,
+                 calc::BatchResult& batch)
+{
+    if (!expression.ok())
+    {
+        batch = all_rows_failed(expression.error(), rows, results);
+        return false;
+    }
+    if (column_count < expression.variables().size())
+    {
+        batch = all_rows_failed(calc::Error::missing_value, rows, results);
+        return false;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Adds failed rows of 'part' to 'batch', the first failed row is the least one of both.
+void merge_failures(calc::BatchResult& batch, const calc::BatchResult& part)
+{
+    if (part.ok)
+        return;
+
+    if (batch.ok || part.first_failed_row < batch.first_failed_row)
+    {
+        batch.error = part.error;
+        batch.first_failed_row = part.first_failed_row;
+        batch.ok = false;
+    }
+    batch.failed_rows += part.failed_rows;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluates rows [begin, end) of the checked expression and adds failed rows to 'batch'.
+void evaluate_rows(const calc::CompiledExpression& expression,
+                   const double* const* columns,
+                   size_t begin,
+                   size_t end,
+                   double* results,
+                   BatchScratch& scratch,
+                   calc::BatchResult& batch)
+{
+    using calc::Instruction;
+    using calc::OpCode;
+    using calc::Operand;
+
+    const calc::kernels::KernelTable& kernels = calc::kernels::best_kernels();
+    uint8_t failed[kBlockRows];
+
+    for (size_t block = begin; block < end; block += kBlockRows)
+    {
+        const size_t n = std::min(kBlockRows, end - block);
+        std::fill_n(failed, n, 0);
+
+        // Returns the block of the operand values.
+        auto operand_block = [&](Operand operand) -> const double*
+        {
+            switch (operand.kind)
+            {
+            case Operand::reg:
+                return scratch.block(operand.index);
+            case Operand::constant:
+                return scratch.constant(operand.index);
+            }
+            return columns[operand.index] + block;
+        };
+
+        for (const Instruction& instruction : expression.program())
+        {
+            const double* a = operand_block(instruction.a);
+            double* out = scratch.block(instruction.dst);
+            if (instruction.code == OpCode::un_min)
+            {
+                kernels.un_min(a, out, n);
+                continue;
+            }
+            if (instruction.code == OpCode::sqrt)
+            {
+                kernels.sqrt(a, out, n);
+                continue;
+            }
+            if (instruction.code == OpCode::recip)
+            {
+                kernels.recip(a, out, n);
+                continue;
+            }
+
+            const double* b = operand_block(instruction.b);
+            switch (instruction.code)
+            {
+            case OpCode::add:
+                kernels.add(a, b, out, n);
+                break;
+            case OpCode::sub:
+                kernels.sub(a, b, out, n);
+                break;
+            case OpCode::mul:
+                kernels.mul(a, b, out, n);
+                break;
+            case OpCode::div:
+                kernels.div(a, b, out, failed, n);
+                break;
+            case OpCode::pow:
+                kernels.pow(a, b, out, n);
+                break;
+            case OpCode::un_min:
+            case OpCode::sqrt:
+            case OpCode::recip:
+                break;
+            }
+        }
+
+        std::copy_n(operand_block(expression.result()), n, results + block);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!failed[i])
+                continue;
+
+            results[block + i] = std::numeric_limits<double>::quiet_NaN();
+            ++batch.failed_rows;
+            if (batch.ok || block + i < batch.first_failed_row)
+            {
+                batch.error = calc::Error::division_by_zero;
+                batch.first_failed_row = block + i;
+                batch.ok = false;
+            }
+        }
+    }
+}
+
+} // anonymous namespace
+
+namespace calc {
+
+// -------------------------------------------------------------------------------------------------
+
+std::string BatchResult::what() const
+{
+    return error_message(error);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+BatchResult evaluate_batch(const CompiledExpression &expression,
+                           const double *const *columns,
+                           size_t column_count,
+                           size_t rows,
+                           double *results)
+{
+    BatchResult batch;
+    if (!check_batch(expression, column_count, rows, results, batch))
+        return batch;
+
+    BatchScratch scratch(expression);
+    evaluate_rows(expression, columns, 0, rows, results, scratch, batch);
+    return batch;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+BatchResult evaluate_batch(const CompiledExpression &expression,
+                           const double *const *columns,
+                           size_t column_count,
+                           size_t rows,
+                           double *results,
+                           ThreadPool &pool)
+{
+    BatchResult batch;
+    if (!check_batch(expression, column_count, rows, results, batch))
+        return batch;
+
+    // Every worker has its own scratch memory and collects failures of its chunks, the failures
+    // are merged when all chunks are done.
+    std::vector<BatchScratch> scratches(pool.size(), BatchScratch(expression));
+    std::vector<BatchResult> failures(pool.size());
+
+    const size_t chunks = (rows + kChunkRows - 1) / kChunkRows;
+    pool.parallel_for(chunks, [&](size_t chunk, size_t worker)
+    {
+        const size_t begin = chunk * kChunkRows;
+        const size_t end = std::min(begin + kChunkRows, rows);
+        evaluate_rows(expression, columns, begin, end, results, scratches[worker],
+                      failures[worker]);
+    });
+
+    for (const BatchResult& failure : failures)
+        merge_failures(batch, failure);
+    return batch;
+}
+
+} // namespace calc
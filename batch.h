@@ -0,0 +1,49 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "equation.h"
+
+#include <cstddef>
+#include <string>
+
+namespace calc {
+
+class ThreadPool;
+
+// Summary of a batch evaluation. Results of the failed rows are set to NaN. The position of the
+// failure is not tracked by rows, CompiledExpression::evaluate() of the first failed row gives it.
+struct BatchResult
+{
+    size_t failed_rows{0}; // the number of rows failed to evaluate
+    size_t first_failed_row{0}; // the index of the first failed row, valid if 'ok' is false
+    Error error{Error::none}; // the reason of the first failure
+    bool ok{true}; // true if all rows were evaluated, otherwise - false
+
+    // Returns the message of the first failure.
+    std::string what() const;
+};
+
+// Evaluates the compiled expression for 'rows' rows of input. The values of the variable in the
+// slot N are taken from columns[N][0 .. rows), 'column_count' is the number of the given columns.
+// The results are written to results[0 .. rows).
+//
+// Every instruction of the expression is executed over a whole block of rows at a time, so the
+// instruction dispatch is paid once per block instead of once per row.
+BatchResult evaluate_batch(const CompiledExpression &expression,
+                           const double *const *columns,
+                           size_t column_count,
+                           size_t rows,
+                           double *results);
+
+// The same as above, but the rows are split into chunks evaluated in parallel by the workers of
+// the pool. The result is the same as the result of the single threaded evaluation.
+BatchResult evaluate_batch(const CompiledExpression &expression,
+                           const double *const *columns,
+                           size_t column_count,
+                           size_t rows,
+                           double *results,
+                           ThreadPool &pool);
+
+} // namespace calc
+
+#endif // BATCH_H
@@ -0,0 +1,346 @@
+#include "batch_kernels.h"
+#include "power.h"
+
+#include <cmath>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CALC_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using calc::kernels::KernelTable;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Scalar kernels
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// These kernels are used on CPUs without any supported vector instruction set and also process the
+// tails of the arrays which are shorter than one vector register.
+
+// -------------------------------------------------------------------------------------------------
+
+void scalar_un_min(const double* a, double* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = -a[i];
+}
+
+void scalar_sqrt(const double* a, double* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = std::sqrt(a[i]);
+}
+
+void scalar_recip(const double* a, double* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = 1.0 / a[i];
+}
+
+void scalar_add(const double* a, const double* b, double* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = a[i] + b[i];
+}
+
+void scalar_sub(const double* a, const double* b, double* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = a[i] - b[i];
+}
+
+void scalar_mul(const double* a, const double* b, double* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = a[i] * b[i];
+}
+
+void scalar_div(const double* a, const double* b, double* out, uint8_t* failed, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        failed[i] |= static_cast<uint8_t>(b[i] == 0.0);
+        out[i] = a[i] / b[i];
+    }
+}
+
+// There is no vector pow() giving the same results as calc::power(), so all instruction sets share
+// this kernel to keep batch results equal to results of CompiledExpression::evaluate().
+void scalar_pow(const double* a, const double* b, double* out, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        out[i] = calc::power(a[i], b[i]);
+}
+
+const KernelTable scalar_kernels = {
+    "scalar",
+    scalar_un_min,
+    scalar_sqrt,
+    scalar_recip,
+    scalar_add,
+    scalar_sub,
+    scalar_mul,
+    scalar_div,
+    scalar_pow
+};
+
+#ifdef CALC_X86_KERNELS
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      x86 vector kernels
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Every kernel is compiled for its own instruction set with the target attribute, so the whole
+// file is built with the default compiler flags and the kernel is chosen at runtime.
+
+#define CALC_TARGET(isa) __attribute__((target(isa)))
+
+// Defines the kernel of a binary operation which has a vector instruction.
+#define CALC_BINARY_KERNEL(name, isa, width, load, store, op, scalar_kernel)                  \
+    CALC_TARGET(isa) void name(const double* a, const double* b, double* out, size_t n)      \
+    {                                                                                          \
+        size_t i = 0;                                                                          \
+        for (; i + width <= n; i += width)                                                     \
+            store(out + i, op(load(a + i), load(b + i)));                                      \
+        scalar_kernel(a + i, b + i, out + i, n - i);                                           \
+    }
+
+// -------------------------------------------------------------------------------------------------
+
+// Sets the failed flags of rows which bits are set in the mask.
+void mark_failed(unsigned int mask, uint8_t* failed)
+{
+    for (; mask != 0; mask &= mask - 1)
+        failed[__builtin_ctz(mask)] = 1;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+CALC_TARGET("sse2") void sse2_un_min(const double* a, double* out, size_t n)
+{
+    const __m128d sign = _mm_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i, _mm_xor_pd(_mm_loadu_pd(a + i), sign));
+    scalar_un_min(a + i, out + i, n - i);
+}
+
+CALC_TARGET("sse2") void sse2_sqrt(const double* a, double* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(a + i)));
+    scalar_sqrt(a + i, out + i, n - i);
+}
+
+CALC_TARGET("sse2") void sse2_recip(const double* a, double* out, size_t n)
+{
+    const __m128d one = _mm_set1_pd(1.0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i, _mm_div_pd(one, _mm_loadu_pd(a + i)));
+    scalar_recip(a + i, out + i, n - i);
+}
+
+CALC_BINARY_KERNEL(sse2_add, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, scalar_add)
+CALC_BINARY_KERNEL(sse2_sub, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, scalar_sub)
+CALC_BINARY_KERNEL(sse2_mul, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, scalar_mul)
+
+CALC_TARGET("sse2")
+void sse2_div(const double* a, const double* b, double* out, uint8_t* failed, size_t n)
+{
+    const __m128d zero = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128d divisor = _mm_loadu_pd(b + i);
+        const int zero_mask = _mm_movemask_pd(_mm_cmpeq_pd(divisor, zero));
+        if (zero_mask != 0)
+            mark_failed(static_cast<unsigned int>(zero_mask), failed + i);
+        _mm_storeu_pd(out + i, _mm_div_pd(_mm_loadu_pd(a + i), divisor));
+    }
+    scalar_div(a + i, b + i, out + i, failed + i, n - i);
+}
+
+const KernelTable sse2_kernels = {
+    "sse2",
+    sse2_un_min,
+    sse2_sqrt,
+    sse2_recip,
+    sse2_add,
+    sse2_sub,
+    sse2_mul,
+    sse2_div,
+    scalar_pow
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// 256-bit floating point arithmetic needs AVX only, AVX2 adds nothing to these kernels.
+
+CALC_TARGET("avx") void avx_un_min(const double* a, double* out, size_t n)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    scalar_un_min(a + i, out + i, n - i);
+}
+
+CALC_TARGET("avx") void avx_sqrt(const double* a, double* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+    scalar_sqrt(a + i, out + i, n - i);
+}
+
+CALC_TARGET("avx") void avx_recip(const double* a, double* out, size_t n)
+{
+    const __m256d one = _mm256_set1_pd(1.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_div_pd(one, _mm256_loadu_pd(a + i)));
+    scalar_recip(a + i, out + i, n - i);
+}
+
+CALC_BINARY_KERNEL(avx_add, "avx", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, scalar_add)
+CALC_BINARY_KERNEL(avx_sub, "avx", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, scalar_sub)
+CALC_BINARY_KERNEL(avx_mul, "avx", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, scalar_mul)
+
+CALC_TARGET("avx")
+void avx_div(const double* a, const double* b, double* out, uint8_t* failed, size_t n)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256d divisor = _mm256_loadu_pd(b + i);
+        const int zero_mask = _mm256_movemask_pd(_mm256_cmp_pd(divisor, zero, _CMP_EQ_OQ));
+        if (zero_mask != 0)
+            mark_failed(static_cast<unsigned int>(zero_mask), failed + i);
+        _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_loadu_pd(a + i), divisor));
+    }
+    scalar_div(a + i, b + i, out + i, failed + i, n - i);
+}
+
+const KernelTable avx_kernels = {
+    "avx",
+    avx_un_min,
+    avx_sqrt,
+    avx_recip,
+    avx_add,
+    avx_sub,
+    avx_mul,
+    avx_div,
+    scalar_pow
+};
+
+// -------------------------------------------------------------------------------------------------
+
+CALC_TARGET("avx512f") void avx512_un_min(const double* a, double* out, size_t n)
+{
+    const __m512i sign = _mm512_set1_epi64(INT64_MIN);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m512i value = _mm512_castpd_si512(_mm512_loadu_pd(a + i));
+        _mm512_storeu_pd(out + i, _mm512_castsi512_pd(_mm512_xor_si512(value, sign)));
+    }
+    scalar_un_min(a + i, out + i, n - i);
+}
+
+// _mm512_sqrt_pd() passes an undefined vector as the masked source and GCC warns that it may be
+// used uninitialized, the zero masked form with the full mask is the same instruction without it.
+CALC_TARGET("avx512f") void avx512_sqrt(const double* a, double* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm512_storeu_pd(out + i, _mm512_maskz_sqrt_pd(0xFF, _mm512_loadu_pd(a + i)));
+    scalar_sqrt(a + i, out + i, n - i);
+}
+
+CALC_TARGET("avx512f") void avx512_recip(const double* a, double* out, size_t n)
+{
+    const __m512d one = _mm512_set1_pd(1.0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm512_storeu_pd(out + i, _mm512_div_pd(one, _mm512_loadu_pd(a + i)));
+    scalar_recip(a + i, out + i, n - i);
+}
+
+CALC_BINARY_KERNEL(avx512_add, "avx512f", 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd,
+                   scalar_add)
+CALC_BINARY_KERNEL(avx512_sub, "avx512f", 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_sub_pd,
+                   scalar_sub)
+CALC_BINARY_KERNEL(avx512_mul, "avx512f", 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_mul_pd,
+                   scalar_mul)
+
+CALC_TARGET("avx512f")
+void avx512_div(const double* a, const double* b, double* out, uint8_t* failed, size_t n)
+{
+    const __m512d zero = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m512d divisor = _mm512_loadu_pd(b + i);
+        const __mmask8 zero_mask = _mm512_cmp_pd_mask(divisor, zero, _CMP_EQ_OQ);
+        if (zero_mask != 0)
+            mark_failed(zero_mask, failed + i);
+        _mm512_storeu_pd(out + i, _mm512_div_pd(_mm512_loadu_pd(a + i), divisor));
+    }
+    scalar_div(a + i, b + i, out + i, failed + i, n - i);
+}
+
+const KernelTable avx512_kernels = {
+    "avx512f",
+    avx512_un_min,
+    avx512_sqrt,
+    avx512_recip,
+    avx512_add,
+    avx512_sub,
+    avx512_mul,
+    avx512_div,
+    scalar_pow
+};
+
+#undef CALC_BINARY_KERNEL
+#undef CALC_TARGET
+
+#endif // CALC_X86_KERNELS
+
+// -------------------------------------------------------------------------------------------------
+
+const KernelTable& select_kernels()
+{
+#ifdef CALC_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return avx512_kernels;
+    if (__builtin_cpu_supports("avx"))
+        return avx_kernels;
+    if (__builtin_cpu_supports("sse2"))
+        return sse2_kernels;
+#endif
+    return scalar_kernels;
+}
+
+} // anonymous namespace
+
+namespace calc::kernels {
+
+// -------------------------------------------------------------------------------------------------
+
+const KernelTable &best_kernels()
+{
+    static const KernelTable& kernels = select_kernels();
+    return kernels;
+}
+
+} // namespace calc::kernels
@@ -0,0 +1,37 @@
+#ifndef BATCH_KERNELS_H
+#define BATCH_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace calc::kernels {
+
+// Kernels apply an operation to 'n' rows of operands. Kernels of the binary operations take the
+// left operands in 'a' and the right ones in 'b', 'out' may be the same array as 'a'.
+using UnaryKernel = void (*)(const double *a, double *out, size_t n);
+using BinaryKernel = void (*)(const double *a, const double *b, double *out, size_t n);
+
+// The division kernel also sets failed[i] to 1 if b[i] is zero, other flags are left untouched.
+using DivKernel = void (*)(const double *a, const double *b, double *out, uint8_t *failed,
+                           size_t n);
+
+struct KernelTable
+{
+    const char *isa; // the name of the instruction set the kernels are built for
+    UnaryKernel un_min;
+    UnaryKernel sqrt;
+    UnaryKernel recip;
+    BinaryKernel add;
+    BinaryKernel sub;
+    BinaryKernel mul;
+    DivKernel div;
+    BinaryKernel pow;
+};
+
+// Returns kernels for the best instruction set supported by the CPU, the choice is made once on
+// the first call.
+const KernelTable &best_kernels();
+
+} // namespace calc::kernels
+
+#endif // BATCH_KERNELS_H
@@ -0,0 +1,153 @@
+#include "batch.h"
+#include "equation.h"
+#include "test_support.h"
+
+#include <string>
+#include <vector>
+
+// Checks of the batch evaluation: every row of the batch gives the same result as the evaluation of
+// the row alone, failed rows give NaN and are counted.
+
+using namespace calc::test;
+
+namespace {
+
+const std::vector<std::string> kVariables = {"a", "b", "c"};
+
+// Rows in columns of the variables a, b and c.
+struct Columns
+{
+    explicit Columns(size_t rows)
+        : rows(rows)
+        , values(kVariables.size() * rows)
+    {
+    }
+
+    const double* column(size_t variable) const
+    {
+        return &values[variable * rows];
+    }
+
+    double& at(size_t variable, size_t row)
+    {
+        return values[variable * rows + row];
+    }
+
+    size_t rows;
+    std::vector<double> values;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Compares the batch with the evaluation of every row alone.
+void check_batch(const std::string& expression,
+                 const calc::CompiledExpression& compiled,
+                 const Columns& columns,
+                 const calc::BatchResult& batch,
+                 const std::vector<double>& results)
+{
+    size_t failed_rows = 0;
+    size_t first_failed_row = 0;
+    calc::Error error = calc::Error::none;
+    for (size_t row = 0; row < columns.rows; ++row)
+    {
+        const double values[] = {columns.column(0)[row], columns.column(1)[row],
+                                 columns.column(2)[row]};
+        const calc::Result reference = compiled.evaluate(values, 3);
+        if (!reference.ok() && failed_rows++ == 0)
+        {
+            first_failed_row = row;
+            error = reference.error;
+        }
+        if (!same_value(results[row], reference.ok() ? reference.result : kNaN))
+        {
+            fail("\"" + expression + "\" row " + std::to_string(row) + " gives "
+                 + std::to_string(results[row]) + " instead of " + describe(reference));
+            return;
+        }
+    }
+
+    check(batch.failed_rows == failed_rows && batch.ok == (failed_rows == 0)
+          && (failed_rows == 0 || (batch.first_failed_row == first_failed_row
+                                   && batch.error == error)),
+          "\"" + expression + "\" reports " + std::to_string(batch.failed_rows)
+          + " failed rows instead of " + std::to_string(failed_rows));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Random expressions over rows of special values. The number of rows is not a multiple of the
+// block, so the last block is partial.
+void check_random_expressions()
+{
+    constexpr int kExpressions = 1000;
+    constexpr size_t kRows = 700;
+
+    ExpressionGenerator generate(7);
+    Columns columns(kRows);
+    std::vector<double> results(kRows);
+    const double* const pointers[] = {columns.column(0), columns.column(1), columns.column(2)};
+    for (int index = 0; index < kExpressions; ++index)
+    {
+        const std::string expression = generate(5);
+        for (size_t row = 0; row < kRows; ++row)
+        {
+            for (size_t variable = 0; variable < kVariables.size(); ++variable)
+                columns.at(variable, row) = generate.value();
+        }
+
+        for (bool optimize : {false, true})
+        {
+            calc::CompileOptions options;
+            options.optimize = optimize;
+            const calc::CompiledExpression compiled =
+                calc::compile(expression.c_str(), kVariables, options);
+            const calc::BatchResult batch =
+                calc::evaluate_batch(compiled, pointers, 3, kRows, results.data());
+            check_batch(expression, compiled, columns, batch, results);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_special_batches()
+{
+    std::vector<double> results(300, 1.0);
+
+    // The constant result is taken from the constant pool for every row.
+    const calc::CompiledExpression constant = calc::compile("2 * 3 + 4");
+    check(calc::evaluate_batch(constant, nullptr, 0, 300, results.data()).ok
+          && results.front() == 10.0 && results.back() == 10.0,
+          "the constant expression gives " + std::to_string(results.back()));
+
+    // The expression which is not compiled fails all rows with its error.
+    const calc::CompiledExpression failed = calc::compile("1 +");
+    calc::BatchResult batch = calc::evaluate_batch(failed, nullptr, 0, 300, results.data());
+    check(!batch.ok && batch.failed_rows == 300 && batch.first_failed_row == 0
+          && batch.error == calc::Error::incorrect_expression && std::isnan(results.back()),
+          "the expression which is not compiled is evaluated");
+
+    // So does the batch without columns of all variables.
+    const calc::CompiledExpression variables = calc::compile("x + y", {"x", "y"});
+    const std::vector<double> column(300, 1.0);
+    const double* const pointers[] = {column.data()};
+    batch = calc::evaluate_batch(variables, pointers, 1, 300, results.data());
+    check(!batch.ok && batch.failed_rows == 300 && batch.error == calc::Error::missing_value,
+          "the batch without the column of y is evaluated");
+
+    // The empty batch does nothing.
+    batch = calc::evaluate_batch(constant, nullptr, 0, 0, results.data());
+    check(batch.ok && batch.failed_rows == 0, "the empty batch fails");
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_random_expressions();
+    check_special_batches();
+    return finish();
+}
@@ -0,0 +1,154 @@
+#include "bulk.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// The chunk is large enough to keep the scheduling cost negligible and small enough to balance
+// workers on lines of different length.
+constexpr size_t kChunkSize = size_t{256} << 10;
+
+// The number of chunks evaluated together per worker. The output of two such groups is kept, one
+// group is written while the next one is evaluated.
+constexpr size_t kChunksPerWorker = 4;
+
+// -------------------------------------------------------------------------------------------------
+
+// Returns the end of the chunk which starts at 'begin': the position following the first line
+// break after kChunkSize characters or the end of the text.
+size_t chunk_end(std::string_view text, size_t begin)
+{
+    if (text.size() - begin <= kChunkSize)
+        return text.size();
+
+    const char* const start = text.data() + begin + kChunkSize;
+    const void* found = std::memchr(start, '\n', text.size() - begin - kChunkSize);
+    return found != nullptr ? static_cast<const char*>(found) - text.data() + 1 : text.size();
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluates the lines of the line-aligned chunk.
+calc::LinesResult evaluate_chunk(std::string_view chunk,
+                                 calc::Context& context,
+                                 std::string& output)
+{
+    calc::LinesResult result;
+    while (!chunk.empty())
+    {
+        const size_t end = std::min(chunk.find('\n'), chunk.size());
+        if (!calc::evaluate_line(chunk.substr(0, end), context, output))
+            ++result.failed_lines;
+        ++result.lines;
+        chunk.remove_prefix(std::min(end + 1, chunk.size()));
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+namespace calc {
+
+// -------------------------------------------------------------------------------------------------
+
+bool evaluate_line(std::string_view line, Context &context, std::string &output)
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+
+    bool ok = true;
+    if (line.find_first_not_of(" \t\v\f") != std::string_view::npos)
+    {
+        const Result result = calculate(line, context);
+        if (result.ok())
+        {
+            char text[32];
+            const auto converted = std::to_chars(text, text + sizeof(text), result.result);
+            output.append(text, converted.ptr);
+        }
+        else
+        {
+            // Some messages have several lines, they are joined, so every expression still gives
+            // exactly one output line.
+            output.append("error: ");
+            const size_t message = output.size();
+            output.append(describe_error(result.error, result.position, line));
+            std::replace(output.begin() + message, output.end(), '\n', ' ');
+            ok = false;
+        }
+    }
+    output.push_back('\n');
+    return ok;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+LinesResult evaluate_lines(std::string_view text, ThreadPool &pool, const OutputWriter &write)
+{
+    // Chunks are evaluated in groups, every worker has its own context, every chunk of the group
+    // has its own output and summary. Groups take turns: while one group is evaluated, one more
+    // task of the same loop writes the output of the previous group, so the output overlaps the
+    // evaluation instead of keeping the workers waiting.
+    struct Group
+    {
+        std::vector<std::string_view> chunks;
+        std::vector<std::string> outputs;
+        std::vector<LinesResult> results;
+        size_t count{0};
+    };
+
+    const size_t group_size = pool.size() * kChunksPerWorker;
+    const auto contexts = std::make_unique<Context[]>(pool.size());
+    Group groups[2];
+    for (Group& group : groups)
+    {
+        group.chunks.resize(group_size);
+        group.outputs.resize(group_size);
+        group.results.resize(group_size);
+    }
+
+    LinesResult total;
+    size_t offset = 0;
+    for (size_t turn = 0;; ++turn)
+    {
+        Group& current = groups[turn % 2];
+        Group& previous = groups[(turn + 1) % 2];
+        for (current.count = 0; current.count < group_size && offset < text.size(); ++current.count)
+        {
+            const size_t end = chunk_end(text, offset);
+            current.chunks[current.count] = text.substr(offset, end - offset);
+            offset = end;
+        }
+        if (current.count == 0 && previous.count == 0)
+            break;
+
+        // The index 0 writes the previous group, it is taken first, mostly by the calling thread.
+        pool.parallel_for(current.count + 1, [&](size_t index, size_t worker)
+        {
+            if (index == 0)
+            {
+                for (size_t chunk = 0; chunk < previous.count; ++chunk)
+                {
+                    total.lines += previous.results[chunk].lines;
+                    total.failed_lines += previous.results[chunk].failed_lines;
+                    write(previous.outputs[chunk]);
+                }
+                return;
+            }
+
+            const size_t chunk = index - 1;
+            current.outputs[chunk].clear();
+            current.results[chunk] =
+                evaluate_chunk(current.chunks[chunk], contexts[worker], current.outputs[chunk]);
+        });
+        previous.count = 0;
+    }
+    return total;
+}
+
+} // namespace calc
@@ -0,0 +1,41 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include "equation.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace calc {
+
+class ThreadPool;
+
+// Summary of the evaluation of expression lines.
+struct LinesResult
+{
+    size_t lines{0}; // the number of lines including the empty ones
+    size_t failed_lines{0}; // the number of expressions failed to evaluate
+};
+
+// Evaluates the expression of one line and appends the output line with the line break to
+// 'output': the shortest text which reads back as the result or "error: <message>", the lines of
+// the message are joined with spaces. The empty line stays empty. Returns false if the expression
+// failed.
+bool evaluate_line(std::string_view line, Context &context, std::string &output);
+
+// Receives the output of evaluate_lines() part by part in the order of the input lines.
+using OutputWriter = std::function<void(std::string_view output)>;
+
+// Evaluates every line of 'text' like evaluate_line() does, lines are separated by '\n' and may
+// end with "\r\n". The text is split into line-aligned chunks evaluated in parallel by the workers
+// of the pool. Expressions are parsed right in 'text', e.g. in the memory mapped file, nothing is
+// copied. The output of the chunks evaluated together is passed to 'write' in input order while
+// the next chunks are evaluated, so the memory taken by the output does not depend on the size of
+// the text. 'write' is called by one thread at a time, but it may be any worker of the pool.
+LinesResult evaluate_lines(std::string_view text, ThreadPool &pool, const OutputWriter &write);
+
+} // namespace calc
+
+#endif // BULK_H
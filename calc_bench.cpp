@@ -0,0 +1,468 @@
+#include "equation.h"
+#include "parser.h"
+#include "power.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+// Every allocation of the process is counted, so benchmarks report the allocations of one
+// operation next to its time.
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+std::atomic<uint64_t> allocated_bytes{0};
+
+void* allocate(size_t size, size_t alignment)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    void* memory = nullptr;
+    if (alignment <= alignof(std::max_align_t))
+        memory = std::malloc(size != 0 ? size : 1);
+    else
+        memory = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+} // anonymous namespace
+
+void* operator new(size_t size)
+{
+    return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size)
+{
+    return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+
+namespace {
+
+// -------------------------------------------------------------------------------------------------
+
+// Counts the allocations of the benchmark loop and reports them per operation.
+class AllocationCounter
+{
+public:
+    explicit AllocationCounter(benchmark::State& state)
+        : state_(state)
+        , allocations_(allocations.load(std::memory_order_relaxed))
+        , bytes_(allocated_bytes.load(std::memory_order_relaxed))
+    {
+    }
+
+    ~AllocationCounter()
+    {
+        const auto per_operation = benchmark::Counter::kAvgIterations;
+        state_.counters["allocs/op"] = benchmark::Counter(
+            static_cast<double>(allocations.load(std::memory_order_relaxed) - allocations_),
+            per_operation);
+        state_.counters["bytes/op"] = benchmark::Counter(
+            static_cast<double>(allocated_bytes.load(std::memory_order_relaxed) - bytes_),
+            per_operation);
+        state_.SetItemsProcessed(state_.iterations());
+    }
+
+private:
+    benchmark::State& state_;
+    uint64_t allocations_;
+    uint64_t bytes_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Corpus
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum Corpus
+{
+    short_expressions,
+    medium_expressions,
+    nested_expressions,
+    long_expressions
+};
+
+const char* const kCorpusNames[] = {"short", "medium", "nested", "long"};
+
+// -------------------------------------------------------------------------------------------------
+
+// Returns a random number without zeros, so the expressions never divide by zero.
+std::string random_number(std::mt19937& random)
+{
+    std::string number = std::to_string(random() % 999 + 1);
+    if (random() % 3 == 0)
+        number += "." + std::to_string(random() % 9 + 1);
+    return number;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+std::string random_operation(std::mt19937& random)
+{
+    static const char* const operations[] = {" + ", " - ", " * ", " / "};
+    return operations[random() % 4];
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Returns "a op b op c ..." with 'operands' numbers.
+std::string random_chain(std::mt19937& random, size_t operands)
+{
+    std::string chain = random_number(random);
+    for (size_t index = 1; index < operands; ++index)
+        chain += random_operation(random) + random_number(random);
+    return chain;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Builds 64 expressions of the corpus, operations take the expressions in turn, so one expression
+// does not stay in the branch predictor.
+std::vector<std::string> make_corpus(Corpus corpus)
+{
+    std::mt19937 random(42);
+    std::vector<std::string> expressions;
+    for (size_t index = 0; index < 64; ++index)
+    {
+        std::string expression;
+        switch (corpus)
+        {
+        case short_expressions:
+            // "12 + 3.5", "-7 * 2"
+            expression = (random() % 4 == 0 ? "-" : "") + random_chain(random, 2);
+            break;
+        case medium_expressions:
+            // About 30 tokens with parentheses, powers and square roots.
+            expression = "(" + random_chain(random, 3) + ") * sqrt(" + random_chain(random, 2)
+                + ") - " + random_number(random) + " ^ 2 / (" + random_chain(random, 3) + ")";
+            break;
+        case nested_expressions:
+            // 60 levels of parentheses: ((((1 + 2) * 3) - 4) ...).
+            expression = std::string(60, '(') + random_number(random);
+            for (size_t depth = 0; depth < 60; ++depth)
+                expression += random_operation(random) + random_number(random) + ")";
+            break;
+        case long_expressions:
+            // 1000 operands without parentheses, about 8 KB of text.
+            expression = random_chain(random, 1000);
+            break;
+        }
+        expressions.push_back(std::move(expression));
+    }
+    return expressions;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+const std::vector<std::string>& corpus(const benchmark::State& state)
+{
+    static const std::vector<std::string> corpora[] = {
+        make_corpus(short_expressions),
+        make_corpus(medium_expressions),
+        make_corpus(nested_expressions),
+        make_corpus(long_expressions)
+    };
+    return corpora[state.range(0)];
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void corpus_arguments(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgName("corpus");
+    for (int corpus = short_expressions; corpus <= long_expressions; ++corpus)
+        benchmark->Arg(corpus);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void set_label(benchmark::State& state)
+{
+    state.SetLabel(kCorpusNames[state.range(0)]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Stages
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Splitting the expression into tokens.
+void BM_Tokenize(benchmark::State& state)
+{
+    const std::vector<std::string>& expressions = corpus(state);
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(calc::ParserStages::count_tokens(expressions[next]));
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_Tokenize)->Apply(corpus_arguments);
+
+// -------------------------------------------------------------------------------------------------
+
+// Building reverse Polish notation in the reused buffers.
+void BM_BuildRpn(benchmark::State& state)
+{
+    const std::vector<std::string>& expressions = corpus(state);
+    calc::Context context;
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(
+            calc::ParserStages::build_reverse_polish_notation(expressions[next], context));
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_BuildRpn)->Apply(corpus_arguments);
+
+// -------------------------------------------------------------------------------------------------
+
+// Constructing the parser and parsing into its new buffers. The grammar tables are constexpr, so
+// the difference from BM_BuildRpn is the growth of the buffers alone.
+void BM_ConstructAndParse(benchmark::State& state)
+{
+    const std::vector<std::string>& expressions = corpus(state);
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(
+            calc::ParserStages::build_reverse_polish_notation(expressions[next]));
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_ConstructAndParse)->Apply(corpus_arguments);
+
+// -------------------------------------------------------------------------------------------------
+
+// Parsing, optimization and code generation into a new expression.
+void BM_Compile(benchmark::State& state)
+{
+    const std::vector<std::string>& expressions = corpus(state);
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        calc::CompiledExpression expression = calc::compile(expressions[next].c_str());
+        benchmark::DoNotOptimize(expression.ok());
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_Compile)->Apply(corpus_arguments);
+
+// -------------------------------------------------------------------------------------------------
+
+// The full calculation without a context, calculate() reuses the context of the thread.
+void BM_Calculate(benchmark::State& state)
+{
+    const std::vector<std::string>& expressions = corpus(state);
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(calc::calculate(expressions[next].c_str()));
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_Calculate)->Apply(corpus_arguments);
+
+// -------------------------------------------------------------------------------------------------
+
+// The full calculation in the reused context, it does not allocate memory once warmed up.
+void BM_CalculateInContext(benchmark::State& state)
+{
+    const std::vector<std::string>& expressions = corpus(state);
+    calc::Context context;
+    for (const std::string& expression : expressions)
+        calc::calculate(expression.c_str(), context);
+
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(calc::calculate(expressions[next].c_str(), context));
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_CalculateInContext)->Apply(corpus_arguments);
+
+// -------------------------------------------------------------------------------------------------
+
+// Compiles the corpus without the optimization, otherwise expressions without variables are folded
+// into a single constant and there is nothing to evaluate.
+bool compile_corpus(benchmark::State& state,
+                    calc::JitMode jit,
+                    std::vector<calc::CompiledExpression>& expressions)
+{
+    calc::CompileOptions options;
+    options.jit = jit;
+    options.optimize = false;
+    for (const std::string& expression : corpus(state))
+    {
+        expressions.push_back(calc::compile(expression.c_str(), options));
+        if (!expressions.back().ok())
+        {
+            state.SkipWithError("the corpus is not compiled");
+            return false;
+        }
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluation of precompiled expressions only, it never allocates memory.
+void BM_Evaluate(benchmark::State& state)
+{
+    std::vector<calc::CompiledExpression> expressions;
+    if (!compile_corpus(state, calc::JitMode::off, expressions))
+        return;
+
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(expressions[next].evaluate());
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_Evaluate)->Apply(corpus_arguments);
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluation of precompiled native code, on platforms without the JIT it is the interpreter again.
+void BM_EvaluateNative(benchmark::State& state)
+{
+    std::vector<calc::CompiledExpression> expressions;
+    if (!compile_corpus(state, calc::JitMode::eager, expressions))
+        return;
+
+    size_t next = 0;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(expressions[next].evaluate());
+        next = (next + 1) % expressions.size();
+    }
+    set_label(state);
+}
+BENCHMARK(BM_EvaluateNative)->Apply(corpus_arguments);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Powers
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const char* const kPowers[] = {"x ^ 2", "x ^ 3", "x ^ 4", "x ^ (-1)", "x ^ 0.5", "x ^ 7"};
+const double kExponents[] = {2.0, 3.0, 4.0, -1.0, 0.5, 7.0};
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluation of x ^ n with the strength reduced power (optimize = 1) and with the pow instruction
+// (optimize = 0), which calls calc::power().
+void BM_Power(benchmark::State& state)
+{
+    calc::CompileOptions options;
+    options.optimize = state.range(1) != 0;
+    const calc::CompiledExpression expression = calc::compile(kPowers[state.range(0)], options);
+    if (!expression.ok())
+    {
+        state.SkipWithError("the expression is not compiled");
+        return;
+    }
+
+    double x = 1.0001;
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(x);
+        benchmark::DoNotOptimize(expression.evaluate(&x, 1));
+    }
+    state.SetLabel(kPowers[state.range(0)]);
+}
+BENCHMARK(BM_Power)
+    ->ArgNames({"power", "optimize"})
+    ->ArgsProduct({{0, 1, 2, 3, 4, 5}, {0, 1}});
+
+// -------------------------------------------------------------------------------------------------
+
+// The pow instruction evaluated x ^ n with std::pow() before calc::power(), this is the cost of the
+// call alone. Compare it with BM_PowerCall and BM_Power to see what the instruction dispatch adds.
+void BM_StdPow(benchmark::State& state)
+{
+    const double exponent = kExponents[state.range(0)];
+    double x = 1.0001;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(x);
+        benchmark::DoNotOptimize(std::pow(x, exponent));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(kPowers[state.range(0)]);
+}
+BENCHMARK(BM_StdPow)->ArgName("power")->DenseRange(0, 5);
+
+// -------------------------------------------------------------------------------------------------
+
+// The call of calc::power(), which takes x * x and 1 / x for the exponents 2 and -1.
+void BM_PowerCall(benchmark::State& state)
+{
+    const double exponent = kExponents[state.range(0)];
+    double x = 1.0001;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(x);
+        benchmark::DoNotOptimize(calc::power(x, exponent));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(kPowers[state.range(0)]);
+}
+BENCHMARK(BM_PowerCall)->ArgName("power")->DenseRange(0, 5);
+
+} // anonymous namespace
+
+BENCHMARK_MAIN();
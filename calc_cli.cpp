@@ -0,0 +1,361 @@
+#include "bulk.h"
+#include "equation.h"
+#include "thread_pool.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CALC_CLI_MMAP 1
+#endif
+
+// Headless calculator: evaluates expressions read line by line from the files given in the
+// command line or from stdin and writes one line per expression to stdout - the result or
+// "error: <message>". Empty lines are copied as they are.
+//
+//   calc_cli [--mmap] [--threads N] [FILE]...
+//
+// Input and output go through large buffers and the output is written only when its buffer is
+// full, so the calculator keeps up with long pipelines. With --mmap files are memory mapped and
+// evaluated in parallel by N threads, all hardware threads by default, stdin ("-") is still read
+// line by line. Exit codes: 0 - all expressions are evaluated, 1 - some expressions failed, 2 - a
+// file cannot be read or the output cannot be written.
+
+namespace {
+
+constexpr size_t kBufferSize = size_t{1} << 20;
+
+// -------------------------------------------------------------------------------------------------
+
+// Reads lines of the file through the large buffer, lines refer to the buffer.
+class LineReader
+{
+public:
+    explicit LineReader(std::FILE* file)
+        : file_(file)
+        , buffer_(kBufferSize)
+    {
+    }
+
+    // Returns the next line without '\n', false at the end of the file. The line is valid until
+    // the next call.
+    bool next(std::string_view& line)
+    {
+        for (;;)
+        {
+            const char* const begin = buffer_.data() + begin_;
+            const size_t size = end_ - begin_;
+            const void* found = std::memchr(begin, '\n', size);
+            if (found != nullptr)
+            {
+                line = std::string_view(begin, static_cast<const char*>(found) - begin);
+                begin_ += line.size() + 1;
+                return true;
+            }
+
+            if (eof_)
+            {
+                line = std::string_view(begin, size);
+                begin_ = end_;
+                return size != 0;
+            }
+            fill();
+        }
+    }
+
+    bool failed() const
+    {
+        return std::ferror(file_) != 0;
+    }
+
+private:
+    // Moves the incomplete line to the front of the buffer, grows the buffer if the line takes it
+    // all, and reads the file after the line.
+    void fill()
+    {
+        std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+        if (buffer_.size() - end_ < kBufferSize / 2)
+            buffer_.resize(buffer_.size() + kBufferSize);
+
+        const size_t read = std::fread(buffer_.data() + end_, 1, buffer_.size() - end_, file_);
+        end_ += read;
+        eof_ = read == 0;
+    }
+
+    std::FILE* file_;
+    std::vector<char> buffer_;
+    size_t begin_{0};
+    size_t end_{0};
+    bool eof_{false};
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Collects the output and writes it when the buffer is full.
+class Output
+{
+public:
+    Output()
+    {
+        buffer_.reserve(kBufferSize);
+    }
+
+    ~Output()
+    {
+        flush();
+    }
+
+    // Returns the buffer to append the output to, commit() writes it if it is full.
+    std::string& buffer()
+    {
+        return buffer_;
+    }
+
+    void commit()
+    {
+        if (buffer_.size() >= kBufferSize)
+            flush();
+    }
+
+    // The large text is written as it is, without copying to the buffer.
+    void write(std::string_view text)
+    {
+        if (buffer_.size() + text.size() > kBufferSize)
+            flush();
+        if (text.size() < kBufferSize)
+            buffer_.append(text);
+        else
+            write_out(text);
+    }
+
+    void flush()
+    {
+        write_out(buffer_);
+        buffer_.clear();
+    }
+
+    bool failed()
+    {
+        flush();
+        return failed_ || std::fflush(stdout) != 0;
+    }
+
+private:
+    void write_out(std::string_view text)
+    {
+        if (!text.empty() && std::fwrite(text.data(), 1, text.size(), stdout) != text.size())
+            failed_ = true;
+    }
+
+    std::string buffer_;
+    bool failed_{false};
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Contents of the file mapped to memory, or read to memory where mapping is not available.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#ifdef CALC_CLI_MMAP
+        if (data_ != nullptr)
+            munmap(data_, size_);
+#endif
+    }
+
+    // Returns false and sets errno if the file cannot be read.
+    bool open(const char* name)
+    {
+#ifdef CALC_CLI_MMAP
+        const int file = ::open(name, O_RDONLY);
+        if (file < 0)
+            return false;
+
+        struct stat status;
+        if (fstat(file, &status) != 0)
+        {
+            const int error = errno;
+            close(file);
+            errno = error;
+            return false;
+        }
+
+        size_ = static_cast<size_t>(status.st_size);
+        if (size_ != 0)
+        {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+            if (data == MAP_FAILED)
+            {
+                const int error = errno;
+                close(file);
+                errno = error;
+                return false;
+            }
+            data_ = static_cast<char*>(data);
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+        close(file);
+        return true;
+#else
+        std::FILE* file = std::fopen(name, "rb");
+        if (file == nullptr)
+            return false;
+
+        char block[1 << 16];
+        for (size_t read; (read = std::fread(block, 1, sizeof(block), file)) != 0;)
+            contents_.insert(contents_.end(), block, block + read);
+        const bool ok = std::ferror(file) == 0;
+        std::fclose(file);
+        data_ = contents_.data();
+        size_ = contents_.size();
+        return ok;
+#endif
+    }
+
+    std::string_view text() const
+    {
+        return std::string_view(data_, size_);
+    }
+
+private:
+    char* data_{nullptr};
+    size_t size_{0};
+#ifndef CALC_CLI_MMAP
+    std::vector<char> contents_;
+#endif
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluates all lines of the file, returns false if some expression failed.
+bool evaluate_stream(LineReader& reader, calc::Context& context, Output& output)
+{
+    bool ok = true;
+    std::string_view line;
+    while (reader.next(line))
+    {
+        ok = calc::evaluate_line(line, context, output.buffer()) && ok;
+        output.commit();
+    }
+    return ok;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void print_usage()
+{
+    std::fprintf(stderr, "usage: calc_cli [--mmap] [--threads N] [FILE]...\n");
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    bool mapped = false;
+    size_t threads = 0;
+    std::vector<const char*> files;
+    for (int index = 1; index < argc; ++index)
+    {
+        const std::string_view argument = argv[index];
+        if (argument == "--mmap")
+        {
+            mapped = true;
+        }
+        else if (argument == "--threads" && index + 1 < argc)
+        {
+            threads = std::strtoul(argv[++index], nullptr, 10);
+        }
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            print_usage();
+            return 2;
+        }
+        else
+        {
+            files.push_back(argv[index]);
+        }
+    }
+    if (files.empty())
+        files.push_back("-");
+
+    calc::Context context;
+    std::unique_ptr<calc::ThreadPool> pool;
+    Output output;
+    int status = 0;
+    for (const char* name : files)
+    {
+        const bool standard_input = std::strcmp(name, "-") == 0;
+        bool ok = true;
+        if (mapped && !standard_input)
+        {
+            MappedFile file;
+            if (!file.open(name))
+            {
+                output.flush();
+                std::fprintf(stderr, "calc_cli: cannot read %s: %s\n", name, std::strerror(errno));
+                status = 2;
+                continue;
+            }
+
+            // The pool is started only for mapped files, so the calculator starts fast otherwise.
+            if (!pool)
+                pool = std::make_unique<calc::ThreadPool>(threads);
+            const calc::LinesResult result = calc::evaluate_lines(
+                file.text(), *pool, [&output](std::string_view text) { output.write(text); });
+            ok = result.failed_lines == 0;
+        }
+        else
+        {
+            std::FILE* file = standard_input ? stdin : std::fopen(name, "rb");
+            if (file == nullptr)
+            {
+                output.flush();
+                std::fprintf(stderr, "calc_cli: cannot open %s: %s\n", name, std::strerror(errno));
+                status = 2;
+                continue;
+            }
+
+            LineReader reader(file);
+            ok = evaluate_stream(reader, context, output);
+            if (reader.failed())
+            {
+                output.flush();
+                std::fprintf(stderr, "calc_cli: cannot read %s\n", name);
+                status = 2;
+            }
+            if (!standard_input)
+                std::fclose(file);
+        }
+
+        if (!ok && status == 0)
+            status = 1;
+    }
+
+    if (output.failed())
+    {
+        std::fprintf(stderr, "calc_cli: cannot write the output\n");
+        status = 2;
+    }
+    return status;
+}
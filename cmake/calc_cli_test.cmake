@@ -0,0 +1,107 @@
+# Checks of the command line calculator, run by ctest as a script:
+#
+#   cmake -DCALC_CLI=<calc_cli> -DWORK_DIR=<directory> -P calc_cli_test.cmake
+#
+# Every check runs calc_cli on the files written to WORK_DIR and compares its output and its exit
+# code with the expected ones, the output of mapped files is compared with the output of the same
+# files read line by line. The script fails with the list of the failed checks.
+
+if(NOT CALC_CLI OR NOT WORK_DIR)
+    message(FATAL_ERROR "CALC_CLI and WORK_DIR must be given")
+endif()
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+set(FAILURES "")
+
+# Runs calc_cli with the arguments and 'input' as stdin, then compares the output with 'expected'
+# and the exit code with 'expected_result'.
+function(check_cli name input expected expected_result)
+    file(WRITE ${WORK_DIR}/${name}.stdin "${input}")
+    execute_process(
+        COMMAND ${CALC_CLI} ${ARGN}
+        WORKING_DIRECTORY ${WORK_DIR}
+        INPUT_FILE ${WORK_DIR}/${name}.stdin
+        OUTPUT_VARIABLE output
+        ERROR_VARIABLE errors
+        RESULT_VARIABLE result
+    )
+    if(NOT output STREQUAL expected)
+        file(WRITE ${WORK_DIR}/${name}.expected "${expected}")
+        file(WRITE ${WORK_DIR}/${name}.output "${output}")
+        list(APPEND FAILURES "${name}: the output differs, see ${WORK_DIR}/${name}.output")
+    endif()
+    if(NOT result STREQUAL expected_result)
+        list(APPEND FAILURES "${name}: the exit code is ${result} instead of ${expected_result}")
+    endif()
+    set(FAILURES ${FAILURES} PARENT_SCOPE)
+endfunction()
+
+string(CONCAT INCORRECT_ORDER
+    "error: Incorrect order of operands and operations in the expression. "
+    "The multiplication sign '*' cannot be after the addition sign '+'")
+set(DIVISION_BY_ZERO "error: Divizion on zero is not defined")
+
+# Results are written in order, one line per expression.
+check_cli(results "1 + 2\n2 ^ 10\n0.1 + 0.2\n2 ^ 0.5\n-(3)\n"
+          "3\n1024\n0.30000000000000004\n1.4142135623730951\n-3\n" 0)
+
+# Empty lines are copied, CRLF line ends are taken for LF, the last line may have no line end and
+# the multi-line message of the failure is joined into one line.
+check_cli(lines "1 + 2\r\n\r\n2 + * 3\n\nsqrt(16)\r\n1 / 0"
+          "3\n\n${INCORRECT_ORDER}\n\n4\n${DIVISION_BY_ZERO}\n" 1)
+check_cli(empty "" "" 0)
+
+# Files are evaluated in the order of the command line, "-" is stdin.
+file(WRITE ${WORK_DIR}/first.txt "1 + 1\n2 + 2\n")
+file(WRITE ${WORK_DIR}/second.txt "3 + 3\n")
+check_cli(files "10 * 10\n" "2\n4\n100\n6\n" 0 first.txt - second.txt)
+
+# The file which cannot be read fails the run with 2, the other files are still evaluated.
+check_cli(missing "" "2\n4\n" 2 missing.txt first.txt)
+check_cli(usage "" "" 2 --unknown)
+
+# Mapped files evaluated in parallel give the output of the files read line by line. The large
+# file is split into many chunks, lines of every kind cross the chunk boundaries.
+function(check_mapped name)
+    execute_process(
+        COMMAND ${CALC_CLI} ${name}
+        WORKING_DIRECTORY ${WORK_DIR}
+        OUTPUT_VARIABLE expected
+        RESULT_VARIABLE expected_result
+    )
+    foreach(threads 1 4)
+        check_cli(${name}-mapped-${threads} "" "${expected}" ${expected_result}
+                  --mmap --threads ${threads} ${name})
+    endforeach()
+    set(FAILURES ${FAILURES} PARENT_SCOPE)
+endfunction()
+
+file(WRITE ${WORK_DIR}/lines.txt "1 + 2\r\n\r\n2 + * 3\n\nsqrt(16)\r\n1 / 0")
+check_mapped(lines.txt)
+file(WRITE ${WORK_DIR}/empty.txt "")
+check_mapped(empty.txt)
+
+set(BLOCK "")
+foreach(term RANGE 1 97)
+    string(APPEND BLOCK "${term} * 1.5 + sqrt(${term}) ^ 3\n(${term} - 1) / (${term} - 7)\n")
+    string(APPEND BLOCK "1 / (${term} - ${term})\r\n\n${term}e-3 + 0x1p-${term}\n")
+endforeach()
+set(TEXT "${BLOCK}")
+foreach(doubling RANGE 1 8)
+    string(APPEND TEXT "${TEXT}")
+endforeach()
+file(WRITE ${WORK_DIR}/large.txt "${TEXT}(1 + 2")
+file(SIZE ${WORK_DIR}/large.txt LARGE_SIZE)
+if(LARGE_SIZE LESS 1048576)
+    list(APPEND FAILURES "large.txt has ${LARGE_SIZE} bytes only")
+endif()
+check_mapped(large.txt)
+
+check_cli(missing-mapped "" "2\n4\n" 2 --mmap missing.txt first.txt)
+
+if(FAILURES)
+    string(REPLACE ";" "\n" FAILURES "${FAILURES}")
+    message(FATAL_ERROR "${FAILURES}")
+endif()
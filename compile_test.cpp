@@ -0,0 +1,184 @@
+#include "equation.h"
+#include "test_support.h"
+
+#include <string>
+#include <vector>
+
+// Checks of compiled expressions: the expression is parsed once and then evaluated many times with
+// the same results as calculate() gives, variables are bound to slots when it is compiled and
+// registers are allocated in Sethi-Ullman order.
+
+using namespace calc::test;
+
+namespace {
+
+// -------------------------------------------------------------------------------------------------
+
+void check_evaluate_many()
+{
+    const calc::CompiledExpression expression = calc::compile("(1 + 2) * sqrt(16) - 2 ^ 3");
+    check(expression.ok(), "the expression is not compiled");
+    for (int index = 0; index < 1000; ++index)
+    {
+        const calc::Result result = expression.evaluate();
+        if (!result.ok() || result.result != 4.0)
+        {
+            fail("evaluation " + std::to_string(index) + " gives " + describe(result));
+            break;
+        }
+    }
+
+    // Copies evaluate the same program.
+    const calc::CompiledExpression copy = expression;
+    check(copy.evaluate().result == 4.0, "the copy gives " + describe(copy.evaluate()));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_failures()
+{
+    // The failure of the compilation is kept and returned by every evaluation.
+    const calc::CompiledExpression failed = calc::compile("2 + * 3");
+    check(!failed.ok() && failed.error() == calc::Error::incorrect_order && failed.position() == 4,
+          "\"2 + * 3\" is compiled");
+    check(failed.evaluate().error == calc::Error::incorrect_order,
+          "\"2 + * 3\" gives " + describe(failed.evaluate()));
+
+    // The division by zero is found by the evaluation, the expression itself is correct.
+    const calc::CompiledExpression divided = calc::compile("1 / (2 - 2)");
+    check(divided.ok(), "\"1 / (2 - 2)\" is not compiled");
+    check(divided.evaluate().error == calc::Error::division_by_zero,
+          "\"1 / (2 - 2)\" gives " + describe(divided.evaluate()));
+
+    // The expression which is not compiled yet is not correct.
+    const calc::CompiledExpression empty;
+    check(!empty.ok() && !empty.evaluate().ok(), "the default expression is correct");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_same_as_calculate()
+{
+    const char* const expressions[] = {
+        "1 + 2 * 3", "-(2) ^ 2", "sqrt(2)", "1e308 * 10", "0.1 * 3", "2 ^ 0.5", "(-8) ^ (1 / 3)"
+    };
+    for (const char* expression : expressions)
+    {
+        const calc::Result compiled = calc::compile(expression).evaluate();
+        const calc::Result calculated = calc::calculate(expression);
+        check(same_result(compiled, calculated, expression),
+              std::string("\"") + expression + "\" gives " + describe(compiled) + " instead of "
+              + describe(calculated));
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_variables()
+{
+    // Variables get slots in order of their first appearance.
+    const calc::CompiledExpression found = calc::compile("b * a + b");
+    size_t a = 0;
+    size_t b = 0;
+    check(found.variables().size() == 2
+          && found.find_variable("a", a) && found.find_variable("b", b) && a == 1 && b == 0,
+          "variables of \"b * a + b\" get wrong slots");
+    check(!found.find_variable("c", a), "\"b * a + b\" has the variable c");
+    const double values[] = {3.0, 2.0};
+    check(found.evaluate(values, 2).result == 9.0,
+          "\"b * a + b\" gives " + describe(found.evaluate(values, 2)));
+
+    // Or in order of the given names, which may be more than the expression uses.
+    const calc::CompiledExpression listed = calc::compile("x - y", {"y", "unused", "x"});
+    const double listed_values[] = {1.0, 100.0, 5.0};
+    check(listed.ok() && listed.evaluate(listed_values, 3).result == 4.0,
+          "\"x - y\" gives " + describe(listed.evaluate(listed_values, 3)));
+
+    // The same variable takes its value from its slot every time.
+    const calc::CompiledExpression repeated = calc::compile("x * x + x", {"x"});
+    for (double x : {0.0, 1.0, -2.0, 0.5})
+    {
+        const double expected = x * x + x;
+        check(same_value(repeated.evaluate(&x, 1).result, expected),
+              "\"x * x + x\" gives " + describe(repeated.evaluate(&x, 1)));
+    }
+
+    // The variable which is not in the list fails the compilation at the variable.
+    const calc::CompiledExpression undefined = calc::compile("x + zz", {"x"});
+    check(undefined.error() == calc::Error::undefined_variable && undefined.position() == 4,
+          "\"x + zz\" does not fail at the undefined variable");
+
+    // Values of all variables must be given.
+    const double one = 1.0;
+    check(found.evaluate(&one, 1).error == calc::Error::missing_value,
+          "\"b * a + b\" is evaluated with one value");
+    check(calc::calculate("x + 1").error == calc::Error::missing_value,
+          "calculate() gives a value to the variable");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Builds the balanced tree of the given depth over the variables x0, x1 and x2 and computes its
+// value the same way.
+std::string balanced_tree(int depth, int& leaf, const double* values, double& value)
+{
+    if (depth == 0)
+    {
+        value = values[leaf % 3];
+        return "x" + std::to_string(leaf++ % 3);
+    }
+
+    double left = 0.0;
+    double right = 0.0;
+    const std::string text = "(" + balanced_tree(depth - 1, leaf, values, left) + " * "
+        + balanced_tree(depth - 1, leaf, values, right) + " + 1)";
+    value = left * right + 1.0;
+    return text;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_registers()
+{
+    calc::CompileOptions options;
+    options.optimize = false;
+
+    // Operands are taken from variables and constants, so the chain needs one register.
+    std::string chain = "x";
+    for (int term = 0; term < 1000; ++term)
+        chain += " + x";
+    const calc::CompiledExpression sum = calc::compile(chain.c_str(), {"x"}, options);
+    const double x = 0.5;
+    check(sum.registers() == 1 && sum.evaluate(&x, 1).result == 500.5,
+          "the chain of 1001 terms takes " + std::to_string(sum.registers()) + " registers");
+
+    // The balanced tree of depth d needs at most d registers.
+    const std::vector<std::string> variables = {"x0", "x1", "x2"};
+    const double values[] = {0.5, -1.25, 3.0};
+    for (int depth = 1; depth <= 12; ++depth)
+    {
+        int leaf = 0;
+        double expected = 0.0;
+        const std::string tree = balanced_tree(depth, leaf, values, expected);
+        const calc::CompiledExpression compiled = calc::compile(tree.c_str(), variables, options);
+        const calc::Result result = compiled.evaluate(values, 3);
+        check(compiled.registers() <= static_cast<size_t>(depth)
+              && result.ok() && same_value(result.result, expected),
+              "the tree of depth " + std::to_string(depth) + " takes "
+              + std::to_string(compiled.registers()) + " registers and gives " + describe(result));
+    }
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_evaluate_many();
+    check_failures();
+    check_same_as_calculate();
+    check_variables();
+    check_registers();
+    return finish();
+}
@@ -1,15 +1,24 @@
 #include "equation.h"
-
+#include "expression_tree.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "power.h"
+
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
-#include <set>
-#include <stack>
-#include <sstream>
+#include <limits>
+#include <memory_resource>
+#include <new>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <variant>
 #include <vector>
-#include <unordered_map>
 
 namespace calc {
 
@@ -26,7 +35,14 @@ enum class Operation
     sqrt
 };
 
-using Value = std::variant<Operation, std::string, double>;
+// Operation of reverse Polish notation and the offset of its token in the expression.
+struct OperationToken
+{
+    Operation operation;
+    uint32_t position;
+};
+
+using Value = std::variant<OperationToken, std::string_view, double>;
 
 template<class... Ts>
 struct overloaded : Ts... { using Ts::operator()...; };
@@ -41,176 +57,252 @@ namespace {
 
 // -------------------------------------------------------------------------------------------------
 
-// This function converts the string to a number only if the full string presents a number.
-bool str_to_number(const char* str, double& number)
+enum class TokType : unsigned int
 {
-    char* endptr = const_cast<char*>(str); // Need const_cast to satisfy strtod().
-    double temp_number = strtod(str, &endptr);
-    if (endptr != str && *endptr == '\0')
-    {
-        number = temp_number;
-        return true;
-    }
-    return false;
-}
+    number,
+    var,
+    open,
+    close,
+    un_min,
+    add,
+    sub,
+    mul,
+    div,
+    pow,
+    sqrt,
+    undefined,
+};
+
+// Token of the expression. The text refers to the expression string, so the token is valid while
+// the string is alive. Numbers are parsed by the tokenizer, so they are scanned only once.
+struct Token
+{
+    TokType type{TokType::undefined};
+    std::string_view text;
+    double number{0.0};
+};
 
 // -------------------------------------------------------------------------------------------------
 
-using Tokens = std::vector<std::string>;
+using calc::is_space;
+using calc::is_symbol;
+
+// Characters are classified without the C locale, so the expression means the same in any locale.
+bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool is_hex_digit(char c)
+{
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
 
-Tokens getTokens(const char* expression)
+char to_lower(char c)
 {
-    // Sanity check.
-    if (expression == nullptr)
-        return {};
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
 
-    auto is_symbol_token = [](char c)
+// -------------------------------------------------------------------------------------------------
+
+// Numbers start with a digit or a point, but the words 'inf', 'infinity' and 'nan' in any case are
+// numbers too, as strtod() used to read them.
+bool special_number(std::string_view word, double& number)
+{
+    auto equals = [word](std::string_view name)
     {
-        switch (c)
+        if (word.size() != name.size())
+            return false;
+        for (size_t i = 0; i < word.size(); ++i)
         {
-        case '-':
-        case '+':
-        case '*':
-        case '/':
-        case '^':
-        case '(':
-        case ')':
-            return true;
+            if (to_lower(word[i]) != name[i])
+                return false;
         }
-        return false;
+        return true;
     };
 
-    const char* c = expression;
-    Tokens tokens;
+    if (equals("inf") || equals("infinity"))
+        number = std::numeric_limits<double>::infinity();
+    else if (equals("nan"))
+        number = std::numeric_limits<double>::quiet_NaN();
+    else
+        return false;
+    return true;
+}
 
-    while (*c != '\0')
+// -------------------------------------------------------------------------------------------------
+
+// std::from_chars() does not give a value to the number out of the double range. Returns infinity
+// if the number overflows and zero if it underflows, like strtod() does: the number overflows if
+// its first significant digit stays left of the point after applying the exponent.
+double out_of_range_value(std::string_view number, bool hex)
+{
+    const char exponent_char = hex ? 'p' : 'e';
+    long order = -1; // the position of the first significant digit relative to the point
+    bool significant = false;
+    bool point = false;
+    size_t i = 0;
+    for (; i < number.size() && to_lower(number[i]) != exponent_char; ++i)
     {
-        while (isspace(*c))
-            ++c;
+        if (number[i] == '.')
+        {
+            point = true;
+        }
+        else if (number[i] != '0' || significant)
+        {
+            significant = true;
+            if (!point)
+                ++order;
+        }
+        else if (point)
+        {
+            --order;
+        }
+    }
 
-        const char* start_token_character = c;
-        std::string token;
+    // Hexadecimal digits are 4 bits and the exponent is binary.
+    if (hex)
+        order *= 4;
 
-        while (*c != '\0')
-        {
-            bool token_found = false;
+    long exponent = 0;
+    const bool negative = ++i < number.size() && number[i] == '-';
+    if (i < number.size() && (number[i] == '-' || number[i] == '+'))
+        ++i;
+    for (; i < number.size(); ++i)
+        exponent = std::min(exponent * 10 + (number[i] - '0'), 1000000L);
+    order += negative ? -exponent : exponent;
 
-            if (start_token_character == c && is_symbol_token(*c))
-            {
-                token_found = true;
-                token.push_back(*c);
-                ++c;
-            }
-            else if (start_token_character == c && (isdigit(*c) || *c == '.'))
-            {
-                token_found = true;               
-                char* endptr{};
-                std::strtod(c, &endptr);
-                token = std::string(c, endptr - c);
-                c += token.size();
-            }
-            else if (isspace(*c) || is_symbol_token(*c))
-            {
-                token_found = true;
-                // End of word.
-            }
-            else
-            {
-                token.push_back(*c);
-                ++c;
-                // End of word.            }
-            }
+    return order >= 0 ? std::numeric_limits<double>::infinity() : 0.0;
+}
 
-            if (token_found)
-                break;
-        }
+// -------------------------------------------------------------------------------------------------
 
-        if (!token.empty())
-            tokens.push_back(token);
+// Reads the number which starts at 'c' with std::from_chars(), it does not depend on the locale and
+// gives the correctly rounded value. Returns the position following the number or 'c' if there is
+// no number. Hexadecimal numbers like 0x1.8p3 are read too, as strtod() used to read them.
+const char* parse_number(const char* c, const char* end, double& number)
+{
+    if (end - c > 2 && c[0] == '0' && to_lower(c[1]) == 'x' && (is_hex_digit(c[2]) || c[2] == '.'))
+    {
+        const auto [ptr, ec] = std::from_chars(c + 2, end, number, std::chars_format::hex);
+        if (ec == std::errc::result_out_of_range)
+            number = out_of_range_value(std::string_view(c + 2, static_cast<size_t>(ptr - c - 2)),
+                                        true);
+        if (ec != std::errc::invalid_argument)
+            return ptr;
     }
 
-    return tokens;
+    const auto [ptr, ec] = std::from_chars(c, end, number, std::chars_format::general);
+    if (ec == std::errc::invalid_argument)
+        return c;
+    if (ec == std::errc::result_out_of_range)
+        number = out_of_range_value(std::string_view(c, static_cast<size_t>(ptr - c)), false);
+    return ptr;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-//
-//      RPN_Builder
-//
-////////////////////////////////////////////////////////////////////////////////////////////////////
-
 // -------------------------------------------------------------------------------------------------
 
-// This calss build reverse Polish notation from the given expression tokens. The used algorithms is
-// https://en.wikipedia.org/wiki/Shunting_yard_algorithm by Dijkstra.
-// The algoritms also checks a correctness of the given expression tokens.
-class RPN_Builder
+// Reads the token which starts at 'c' after spaces, 'end' is the end of the expression. Returns
+// the position following the token, the token type is undefined at the end of the expression.
+// Minus is always the subtraction, resolve_minus() tells the unary one by the previous token.
+const char* next_token(const char* c, const char* end, Token& token)
 {
-public:
-    explicit RPN_Builder();
-
-    const std::vector<calc::Value>& reverse_polish_notation() const;
-    const std::string& what() const;
+    // The type of the symbol, is_symbol() tells which characters are symbols.
+    auto symbol_type = [](char c)
+    {
+        switch (c)
+        {
+        case '-': return TokType::sub;
+        case '+': return TokType::add;
+        case '*': return TokType::mul;
+        case '/': return TokType::div;
+        case '^': return TokType::pow;
+        case '(': return TokType::open;
+        case ')': return TokType::close;
+        }
+        return TokType::undefined;
+    };
 
-    bool operator()(const Tokens& expression_tokens);
+    while (c != end && is_space(*c))
+        ++c;
 
-private:
-    enum class TokType : unsigned int
+    const char* start = c;
+    token.number = 0.0;
+    token.type = c != end && is_symbol(*c) ? symbol_type(*c) : TokType::undefined;
+    if (c == end)
     {
-        number,
-        var,
-        open,
-        close,
-        un_min,
-        add,
-        sub,
-        mul,
-        div,
-        pow,
-        sqrt,
-        undefined,
-    };
+        // The end of the expression, the type is undefined.
+    }
+    else if (token.type != TokType::undefined)
+    {
+        ++c;
+    }
+    else
+    {
+        if (is_digit(*c) || *c == '.')
+            c = parse_number(c, end, token.number);
 
-    // Converts input token to token type.
-    TokType to_token_type(const std::string& token, double& number) const;
+        if (c != start)
+        {
+            token.type = TokType::number;
+        }
+        else
+        {
+            // The word lasts up to a space or a symbol, it is a function, a special number like
+            // 'inf' or a variable.
+            while (c != end && !is_space(*c) && !is_symbol(*c))
+                ++c;
 
-    // Converts private TokType to public calc::Operation.
-    calc::Operation to_operation(TokType ttype) const;
+            const std::string_view word(start, static_cast<size_t>(c - start));
+            if (word == "sqrt")
+                token.type = TokType::sqrt;
+            else if (special_number(word, token.number))
+                token.type = TokType::number;
+            else
+                token.type = TokType::var;
+        }
+    }
 
-    // Returns priority of math operations and parentheses.
-    uint32_t priority(TokType ttype) const;
+    token.text = std::string_view(start, static_cast<size_t>(c - start));
+    return c;
+}
 
-    // Checks correctness of tokens order - previous and current tokens.
-    bool is_correct_token_order(TokType prev_ttype, TokType curr_ttype) const;
+// -------------------------------------------------------------------------------------------------
 
-    // These functions fill 'what_happened_message_' and return false.
-    bool extra_parentheses_happened(const std::string& type);
-    bool incorrect_token_order_happened(
-        TokType         prev_ttype,
-        const std::string& prev_token,
-        TokType         curr_ttype,
-        const std::string& curr_token);
-    bool no_operands_found();
+// Returns the type of the token which follows the token of 'prev_ttype': minus at the beginning of
+// the expression or after the open parenthesis is the unary one.
+TokType resolve_minus(TokType prev_ttype, TokType ttype)
+{
+    const bool maybe_un_min = prev_ttype == TokType::undefined || prev_ttype == TokType::open;
+    return maybe_un_min && ttype == TokType::sub ? TokType::un_min : ttype;
+}
 
-    // Keep built reverse Polish notation.
-    std::vector<calc::Value> rp_notation_;
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      RPN_Builder
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    // Map keeps tokens and its corresponding types, unspecified tokens are numbers or variables.
-    std::unordered_map<std::string, TokType> tokens_map_;
+// -------------------------------------------------------------------------------------------------
 
-    // Map keeps the correct order of two nearest tokens. The key is a previous token type and
-    // value is a set of permitted current token types.
-    std::unordered_map<TokType, std::set<TokType>> prev_curr_token_map_;
+// Set of token types, the bit 'n' stands for the token type with the value 'n'.
+using TokTypeSet = uint32_t;
+static_assert(static_cast<unsigned int>(TokType::undefined) < 32, "TokTypeSet is too small");
 
-    // Keeps error message for upper caller.
-    std::string what_happened_message_;
-};
+constexpr TokTypeSet token_set(std::initializer_list<TokType> ttypes)
+{
+    TokTypeSet set = 0;
+    for (TokType ttype : ttypes)
+        set |= TokTypeSet{1} << static_cast<unsigned int>(ttype);
+    return set;
+}
 
 // -------------------------------------------------------------------------------------------------
 
 // +-------------+--------------- +
 // |   Previous  | Next permitted |
 // |  token type |   token type   |      Table shows the correct order of two nearest token types -
-// +-------------+----------------+      previous and current, it is kept in 'prev_curr_token_map_'.
+// +-------------+----------------+      previous and current, it is kept in 'kNextTokenTypes'.
 // |             |       +        |      It is used to check correctness of input expression tokens
 // |    number   |       - (sub)  |      from which the reverse Polish notation is built.
 // |   variable  |       *        |
@@ -233,28 +325,19 @@ private:
 // |             |   variable     |
 // |             |      (         |
 // +-------------+--------------- +
-RPN_Builder::RPN_Builder()
-{
-    tokens_map_["("]    = TokType::open;
-    tokens_map_[")"]    = TokType::close;
-    tokens_map_["+"]    = TokType::add;
-    tokens_map_["-"]    = TokType::sub;
-    tokens_map_["*"]    = TokType::mul;
-    tokens_map_["/"]    = TokType::div;
-    tokens_map_["^"]    = TokType::pow;
-    tokens_map_["sqrt"] = TokType::sqrt;
-
-    // Fill 'prev_curr_token_map_' to help faster checking of token order correstness.
+constexpr auto kNextTokenTypes = []()
+{
+    std::array<TokTypeSet, static_cast<size_t>(TokType::undefined) + 1> next{};
     for (TokType ttype : {TokType::number, TokType::var, TokType::close})
     {
-        prev_curr_token_map_[ttype] = {
+        next[static_cast<size_t>(ttype)] = token_set({
             TokType::add,
             TokType::sub,
             TokType::mul,
             TokType::div,
             TokType::pow,
             TokType::close
-        };
+        });
     }
     std::initializer_list<TokType> op_list = {
         TokType::un_min,
@@ -266,73 +349,170 @@ RPN_Builder::RPN_Builder()
     };
     for (TokType ttype : op_list)
     {
-        prev_curr_token_map_[ttype] = {
+        next[static_cast<size_t>(ttype)] = token_set({
             TokType::number,
             TokType::var,
             TokType::open,
             TokType::sqrt
-        };
+        });
     }
     for (TokType ttype : {TokType::undefined, TokType::open})
     {
-        prev_curr_token_map_[ttype] = {
+        next[static_cast<size_t>(ttype)] = token_set({
             TokType::number,
             TokType::var,
             TokType::open,
             TokType::un_min,
             TokType::sqrt
-        };
+        });
     }
-    prev_curr_token_map_[TokType::sqrt] = {TokType::open};
+    next[static_cast<size_t>(TokType::sqrt)] = token_set({TokType::open});
+    return next;
+}();
+
+// -------------------------------------------------------------------------------------------------
+
+// This calss build reverse Polish notation from the given expression. The used algorithms is
+// https://en.wikipedia.org/wiki/Shunting_yard_algorithm by Dijkstra.
+// The algoritms also checks a correctness of the given expression tokens. Tokens are read one by
+// one in the same loop, so the expression is scanned only once.
+class RPN_Builder
+{
+public:
+    explicit RPN_Builder(std::pmr::memory_resource* memory);
+
+    const std::pmr::vector<calc::Value>& reverse_polish_notation() const;
+
+    // Returns the code of the failure and the offset of the token which caused it.
+    calc::Error error() const;
+    uint32_t position() const;
+
+    bool operator()(std::string_view expression);
+
+private:
+    // Converts private TokType to public calc::Operation.
+    calc::Operation to_operation(TokType ttype) const;
+
+    // Returns priority of math operations and parentheses.
+    uint32_t priority(TokType ttype) const;
+
+    // Checks correctness of tokens order - previous and current tokens.
+    bool is_correct_token_order(TokType prev_ttype, TokType curr_ttype) const;
+
+    // Returns the offset of the token in the expression.
+    uint32_t position_of(std::string_view token) const;
+
+    // These functions fill 'error_' and 'position_' and return false. The message is built by
+    // calc::describe_error() only if it is asked.
+    bool extra_parentheses_happened(calc::Error error, uint32_t position);
+    bool incorrect_token_order_happened(std::string_view curr_token);
+    bool no_operands_found();
+
+    // Operation of the operation stack and the offset of its token.
+    struct PendingOperation
+    {
+        TokType type;
+        uint32_t position;
+    };
+
+    // Keep built reverse Polish notation.
+    std::pmr::vector<calc::Value> rp_notation_;
+
+    // The operation stack of the algorithm, it is kept to reuse its memory.
+    std::pmr::vector<PendingOperation> operations_;
+
+    // The expression being parsed.
+    std::string_view expression_;
+
+    // Keeps the failure for upper caller.
+    calc::Error error_{calc::Error::none};
+    uint32_t position_{0};
+};
+
+// -------------------------------------------------------------------------------------------------
+
+RPN_Builder::RPN_Builder(std::pmr::memory_resource* memory)
+    : rp_notation_(memory)
+    , operations_(memory)
+{
 }
 
 // -------------------------------------------------------------------------------------------------
 
-const std::vector<calc::Value>& RPN_Builder::reverse_polish_notation() const
+const std::pmr::vector<calc::Value>& RPN_Builder::reverse_polish_notation() const
 {
     return rp_notation_;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-const std::string& RPN_Builder::what() const
+calc::Error RPN_Builder::error() const
+{
+    return error_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint32_t RPN_Builder::position() const
 {
-    return what_happened_message_;
+    return position_;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-bool RPN_Builder::operator()(const Tokens& expression_tokens)
+uint32_t RPN_Builder::position_of(std::string_view token) const
+{
+    return static_cast<uint32_t>(token.data() - expression_.data());
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool RPN_Builder::operator()(std::string_view expression)
 {
     rp_notation_.clear();
-    std::string prev_token;
+    operations_.clear();
+    expression_ = expression;
+    error_ = calc::Error::none;
+    position_ = 0;
     TokType prev_ttype = TokType::undefined;
     TokType curr_ttype = TokType::undefined;
-    std::stack<TokType> operations;
     size_t operand_count = 0;
 
-    for (const std::string& token : expression_tokens)
+    // Pops operations up to the open parenthesis or the operation of a lower priority.
+    auto pop_operations = [this](uint32_t min_priority)
+    {
+        while (!operations_.empty() && priority(operations_.back().type) >= min_priority)
+        {
+            const PendingOperation& operation = operations_.back();
+            calc::Value value =
+                calc::OperationToken{to_operation(operation.type), operation.position};
+            rp_notation_.push_back(value);
+            operations_.pop_back();
+        }
+    };
+
+    const char* const end = expression.data() + expression.size();
+    Token token;
+    for (const char* c = next_token(expression.data(), end, token);
+         token.type != TokType::undefined;
+         c = next_token(c, end, token))
     {
-        double number = 0.0;
-        curr_ttype = to_token_type(token, number);
-        bool maybe_un_min = prev_ttype == TokType::undefined || prev_ttype == TokType::open;
-        if (maybe_un_min && curr_ttype == TokType::sub)
-            curr_ttype = TokType::un_min;
+        curr_ttype = resolve_minus(prev_ttype, token.type);
         if (!is_correct_token_order(prev_ttype, curr_ttype))
-            return incorrect_token_order_happened(prev_ttype, prev_token, curr_ttype, token);
+            return incorrect_token_order_happened(token.text);
 
         switch (curr_ttype)
         {
         case TokType::number:
         {
-            calc::Value value = number;
+            calc::Value value = token.number;
             rp_notation_.push_back(value);
             ++operand_count;
             break;
         }
         case TokType::var:
         {
-            calc::Value value = token;
+            calc::Value value = token.text;
             rp_notation_.push_back(value);
             ++operand_count;
             break;
@@ -340,21 +520,18 @@ bool RPN_Builder::operator()(const Tokens& expression_tokens)
         case TokType::sqrt:
         case TokType::open:
         {
-            operations.push(curr_ttype);
+            operations_.push_back({curr_ttype, position_of(token.text)});
             break;
         }
         case TokType::close:
         {
-            while(!operations.empty() && operations.top() != TokType::open)
-            {
-                calc::Value value = to_operation(operations.top());
-                rp_notation_.push_back(value);
-                operations.pop();
-            }
-            if (operations.empty())
-                return extra_parentheses_happened("close");
+            // Parentheses have the lowest priority, so only operations are popped.
+            pop_operations(1);
+            if (operations_.empty())
+                return extra_parentheses_happened(calc::Error::extra_close_parenthesis,
+                                                  position_of(token.text));
             else
-                operations.pop(); // Open parenthesis is found.
+                operations_.pop_back(); // Open parenthesis is found.
 
             break;
         }
@@ -365,39 +542,33 @@ bool RPN_Builder::operator()(const Tokens& expression_tokens)
         case TokType::pow:
         case TokType::un_min:
         {
-            uint32_t curr_prior = priority(curr_ttype);
-            uint32_t top_prior = operations.empty() ? 0 : priority(operations.top());
-            while (top_prior >= curr_prior)
-            {
-                calc::Value value = to_operation(operations.top());
-                rp_notation_.push_back(value);
-                operations.pop();
-                top_prior = operations.empty() ? 0 : priority(operations.top());
-            }
-            operations.push(curr_ttype);
+            pop_operations(priority(curr_ttype));
+            operations_.push_back({curr_ttype, position_of(token.text)});
             break;
         }
         case TokType::undefined:
         {
-            // We should not be here.
-            throw std::runtime_error("Incorrect expression");
+            // We should not be here, the loop stops at the undefined token.
+            assert(false);
+            break;
         }
         }
         prev_ttype = curr_ttype;
-        prev_token = token;
     }
 
     if (operand_count == 0)
         return no_operands_found();
 
-    while (!operations.empty())
+    while (!operations_.empty())
     {
-        if (operations.top() == TokType::open)
-            return extra_parentheses_happened("open");
+        const PendingOperation& operation = operations_.back();
+        if (operation.type == TokType::open)
+            return extra_parentheses_happened(calc::Error::extra_open_parenthesis,
+                                              operation.position);
 
-        calc::Value value = to_operation(operations.top());
+        calc::Value value = calc::OperationToken{to_operation(operation.type), operation.position};
         rp_notation_.push_back(value);
-        operations.pop();
+        operations_.pop_back();
     }
 
     return true;
@@ -405,22 +576,6 @@ bool RPN_Builder::operator()(const Tokens& expression_tokens)
 
 // -------------------------------------------------------------------------------------------------
 
-RPN_Builder::TokType RPN_Builder::to_token_type(const std::string& token, double& number) const
-{
-    auto ttype_iter = tokens_map_.find(token);
-    if (ttype_iter != tokens_map_.end())
-        return ttype_iter->second;
-
-    if (str_to_number(token.c_str(), number))
-    {
-        return TokType::number;
-    }
-
-    return TokType::var;
-}
-
-// -------------------------------------------------------------------------------------------------
-
 calc::Operation RPN_Builder::to_operation(TokType ttype) const
 {
     switch (ttype)
@@ -447,7 +602,8 @@ calc::Operation RPN_Builder::to_operation(TokType ttype) const
         break;
     }
 
-    throw std::runtime_error("Incorrect expression");
+    // Parentheses and operands are never converted.
+    assert(false);
     return calc::Operation::un_min;
 }
 
@@ -477,7 +633,9 @@ uint32_t RPN_Builder::priority(TokType ttype) const
     case TokType::undefined:
         break;
     }
-    throw std::runtime_error("Incorrect expression");
+
+    // Operands never get to the operation stack.
+    assert(false);
     return 0;
 }
 
@@ -485,68 +643,25 @@ uint32_t RPN_Builder::priority(TokType ttype) const
 
 bool RPN_Builder::is_correct_token_order(TokType prev_ttype, TokType curr_ttype) const
 {
-    if(curr_ttype == TokType::undefined) {
-        throw std::runtime_error("Incorrect expression");
-    }
-
-    const std::set<TokType>& curr_ttype_set = prev_curr_token_map_.at(prev_ttype);
-    return curr_ttype_set.find(curr_ttype) != curr_ttype_set.end();
+    return (kNextTokenTypes[static_cast<size_t>(prev_ttype)] & token_set({curr_ttype})) != 0;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-bool RPN_Builder::extra_parentheses_happened(const std::string& type)
+bool RPN_Builder::extra_parentheses_happened(calc::Error error, uint32_t position)
 {
-    std::stringstream ss;
-    ss << "Found extra " << type << " parentheses.";
-    what_happened_message_ = ss.str();
+    error_ = error;
+    position_ = position;
 
     return false;
 }
 
 // -------------------------------------------------------------------------------------------------
 
-bool
-RPN_Builder::incorrect_token_order_happened(
-    TokType         prev_ttype,
-    const std::string& prev_token,
-    TokType         curr_ttype,
-    const std::string& curr_token)
+bool RPN_Builder::incorrect_token_order_happened(std::string_view curr_token)
 {
-    if (curr_ttype == TokType::undefined) {
-        throw std::runtime_error("Incorrect expression");
-    }
-
-    auto ttype_to_str = [](TokType ttype, const std::string& token) -> std::string
-    {
-        switch (ttype)
-        {
-        case TokType::number:    return "number " + token;
-        case TokType::var:       return "variable " + token;
-        case TokType::open:      return "open parenthesis";
-        case TokType::close:     return "close parenthesis";
-        case TokType::un_min:    return "unary minus '-'";
-        case TokType::add:       return "addition sign '+'";
-        case TokType::sub:       return "subtraction sign '-'";
-        case TokType::mul:       return "multiplication sign '*'";
-        case TokType::div:       return "division sign '/'";
-        case TokType::pow:       return "power sign '^'";
-        case TokType::sqrt:      return "sqrt function";
-        case TokType::undefined: break;
-        }
-        return "undefined";
-    };
-
-    std::stringstream ss;
-    ss << "Incorrect order of operands and operations in the expression.\n" << "The "
-       << ttype_to_str(curr_ttype, curr_token) << " cannot be ";
-    if (prev_ttype == TokType::undefined)
-        ss << "the first in an expression.";
-    else
-    {
-        ss << "after the " << ttype_to_str(prev_ttype, prev_token);
-    }
-    what_happened_message_ = ss.str();
+    error_ = calc::Error::incorrect_order;
+    position_ = position_of(curr_token);
 
     return false;
 }
@@ -555,7 +670,8 @@ RPN_Builder::incorrect_token_order_happened(
 
 bool RPN_Builder::no_operands_found()
 {
-    what_happened_message_ = "Expression does not contain any operands.";
+    error_ = calc::Error::no_operands;
+    position_ = 0;
 
     return false;
 }
@@ -563,99 +679,700 @@ bool RPN_Builder::no_operands_found()
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//      Calculator
+//      Diagnostics
 //
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 // -------------------------------------------------------------------------------------------------
 
-double pop_value(std::stack<double>& stack)
+// Appends the description of the token to 'message'.
+void append_token(TokType ttype, std::string_view token, std::string& message)
 {
-    if (stack.empty()) {
-        throw std::runtime_error("Incorrect expression");
+    switch (ttype)
+    {
+    case TokType::number:    message.append("number ").append(token); return;
+    case TokType::var:       message.append("variable ").append(token); return;
+    case TokType::open:      message.append("open parenthesis"); return;
+    case TokType::close:     message.append("close parenthesis"); return;
+    case TokType::un_min:    message.append("unary minus '-'"); return;
+    case TokType::add:       message.append("addition sign '+'"); return;
+    case TokType::sub:       message.append("subtraction sign '-'"); return;
+    case TokType::mul:       message.append("multiplication sign '*'"); return;
+    case TokType::div:       message.append("division sign '/'"); return;
+    case TokType::pow:       message.append("power sign '^'"); return;
+    case TokType::sqrt:      message.append("sqrt function"); return;
+    case TokType::undefined: break;
     }
-
-    double value = stack.top();
-    stack.pop();
-    return value;
+    message.append("undefined");
 }
 
 // -------------------------------------------------------------------------------------------------
 
-template <class F>
-double binary_operation(F op, std::stack<double>& stack)
+// Builds the message of the tokens in the wrong order, the current token starts at 'position'.
+// Returns false if there is no token at the position.
+bool describe_token_order(std::string_view expression, uint32_t position, std::string& message)
 {
-    return op(pop_value(stack), pop_value(stack));
+    const char* const end = expression.data() + expression.size();
+    std::string_view prev_token;
+    TokType prev_ttype = TokType::undefined;
+    Token token;
+    for (const char* c = next_token(expression.data(), end, token);
+         token.type != TokType::undefined;
+         c = next_token(c, end, token))
+    {
+        const TokType curr_ttype = resolve_minus(prev_ttype, token.type);
+        if (token.text.data() == expression.data() + position)
+        {
+            message = "Incorrect order of operands and operations in the expression.\nThe ";
+            append_token(curr_ttype, token.text, message);
+            message.append(" cannot be ");
+            if (prev_ttype == TokType::undefined)
+            {
+                message.append("the first in an expression.");
+            }
+            else
+            {
+                message.append("after the ");
+                append_token(prev_ttype, prev_token, message);
+            }
+            return true;
+        }
+        prev_ttype = curr_ttype;
+        prev_token = token.text;
+    }
+    return false;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Calculator
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 // -------------------------------------------------------------------------------------------------
 
-template <class F>
-double unary_operation(F op, std::stack<double>& stack)
+// Converts the operation of reverse Polish notation to the instruction code.
+calc::OpCode to_op_code(calc::Operation op)
 {
-    return op(pop_value(stack));
+    switch (op)
+    {
+    case calc::Operation::un_min: return calc::OpCode::un_min;
+    case calc::Operation::add:    return calc::OpCode::add;
+    case calc::Operation::sub:    return calc::OpCode::sub;
+    case calc::Operation::mul:    return calc::OpCode::mul;
+    case calc::Operation::div:    return calc::OpCode::div;
+    case calc::Operation::pow:    return calc::OpCode::pow;
+    case calc::Operation::sqrt:   return calc::OpCode::sqrt;
+    }
+
+    assert(false);
+    return calc::OpCode::add;
 }
 
-double calculate(calc::Operation op, std::stack<double>& stack)
+// -------------------------------------------------------------------------------------------------
+
+// The number of registers allocated on the native stack, so the evaluation never allocates memory.
+// Registers are allocated in Sethi-Ullman order, a tree of N leaves needs at most log2(N) + 1 of
+// them. Merged subexpressions may need more, build() compiles the unmerged tree then, and only the
+// expression which needs more registers even without merging is too complex.
+constexpr size_t kMaxRegisters = 64;
+
+// GCC and Clang support labels as values, so the program is dispatched with computed goto: every
+// instruction jumps straight to the next one and the CPU predicts every jump on its own.
+#if defined(__GNUC__) || defined(__clang__)
+#define CALC_COMPUTED_GOTO
+#endif
+
+// Executes the validated non-empty program. Operands are taken from bases[kind][index], where
+// bases[calc::Operand::reg] are registers. Returns the instruction which divided by zero or null if
+// the program is done.
+const calc::Instruction* execute(const calc::Instruction* ip,
+                                 const calc::Instruction* end,
+                                 const double* const* bases)
 {
-    switch (op)
+    double* registers = const_cast<double*>(bases[calc::Operand::reg]);
+
+#define CALC_A bases[ip->a.kind][ip->a.index]
+#define CALC_B bases[ip->b.kind][ip->b.index]
+#define CALC_DST registers[ip->dst]
+
+#ifdef CALC_COMPUTED_GOTO
+    // The order of labels follows the order of calc::OpCode.
+    static const void* const labels[] = {
+        &&op_un_min,
+        &&op_add,
+        &&op_sub,
+        &&op_mul,
+        &&op_div,
+        &&op_pow,
+        &&op_sqrt,
+        &&op_recip
+    };
+#define CALC_OP(name) op_##name
+#define CALC_NEXT()                                                                            \
+    do {                                                                                       \
+        if (++ip == end)                                                                       \
+            return nullptr;                                                                    \
+        goto *labels[static_cast<size_t>(ip->code)];                                           \
+    } while (false)
+
+    goto *labels[static_cast<size_t>(ip->code)];
+#else
+#define CALC_OP(name) case calc::OpCode::name
+#define CALC_NEXT()                                                                            \
+    if (++ip == end)                                                                           \
+        return nullptr;                                                                        \
+    continue
+
+    for (;;)
     {
-    case calc::Operation::add:
-        return binary_operation([](double a, double b){ return a + b; }, stack);
-    case calc::Operation::sub:
-        return binary_operation([](double a, double b){ return a - b; }, stack);
-    case calc::Operation::mul:
-        return binary_operation([](double a, double b){ return a * b; }, stack);
-    case calc::Operation::div:
-        return binary_operation([](double a, double b){
-            if (b == 0.0) {
-                throw std::runtime_error("Divizion on zero is not defined");
-            }
-            return a / b;
-        }, stack);
-    case calc::Operation::pow:
-        return binary_operation([](double a, double b){ return pow(a, b); }, stack);
-    case calc::Operation::un_min:
-        return unary_operation([](double a){ return -a; }, stack);
-    case calc::Operation::sqrt:
-        return unary_operation([](double a){ return sqrt(a); }, stack);
+        switch (ip->code)
+        {
+#endif
+
+    CALC_OP(un_min):
+        CALC_DST = -CALC_A;
+        CALC_NEXT();
+    CALC_OP(add):
+        CALC_DST = CALC_A + CALC_B;
+        CALC_NEXT();
+    CALC_OP(sub):
+        CALC_DST = CALC_A - CALC_B;
+        CALC_NEXT();
+    CALC_OP(mul):
+        CALC_DST = CALC_A * CALC_B;
+        CALC_NEXT();
+    CALC_OP(div):
+        if (CALC_B == 0.0)
+            return ip;
+        CALC_DST = CALC_A / CALC_B;
+        CALC_NEXT();
+    CALC_OP(pow):
+        CALC_DST = calc::power(CALC_A, CALC_B);
+        CALC_NEXT();
+    CALC_OP(sqrt):
+        CALC_DST = std::sqrt(CALC_A);
+        CALC_NEXT();
+    CALC_OP(recip):
+        CALC_DST = 1.0 / CALC_A;
+        CALC_NEXT();
+
+#ifndef CALC_COMPUTED_GOTO
+        }
     }
+#endif
 
-    throw std::runtime_error("Incorrect expression");
-    return 0;
+#undef CALC_NEXT
+#undef CALC_OP
+#undef CALC_DST
+#undef CALC_B
+#undef CALC_A
 }
 
+// -------------------------------------------------------------------------------------------------
+
+calc::Result failure(calc::Error error, uint32_t position)
+{
+    calc::Result result;
+    result.error = error;
+    result.position = position;
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Returns the resource given by the caller or the default one.
+std::pmr::memory_resource* memory_or_default(std::pmr::memory_resource* memory)
+{
+    return memory != nullptr ? memory : std::pmr::get_default_resource();
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Returns the characters of the NUL terminated expression, null is the empty expression.
+std::string_view view_of(const char* equation)
+{
+    return equation != nullptr ? std::string_view(equation) : std::string_view();
+}
 
 } // anonymous namespace
 
 namespace calc {
 
-Result calculate(const char *equation)
+// -------------------------------------------------------------------------------------------------
+
+const char* error_message(Error error)
+{
+    switch (error)
+    {
+    case Error::none:                    return "";
+    case Error::division_by_zero:        return "Divizion on zero is not defined";
+    case Error::incorrect_expression:    return "Incorrect expression";
+    case Error::incorrect_order:
+        return "Incorrect order of operands and operations in the expression.";
+    case Error::extra_open_parenthesis:  return "Found extra open parentheses.";
+    case Error::extra_close_parenthesis: return "Found extra close parentheses.";
+    case Error::no_operands:             return "Expression does not contain any operands.";
+    case Error::undefined_variable:      return "Variable is not defined.";
+    case Error::missing_value:           return "Values of the variables are not given.";
+    case Error::too_complex:             return "Expression is too complex";
+    case Error::out_of_memory:           return "Not enough memory";
+    }
+    return "Something went wrong";
+}
+
+// -------------------------------------------------------------------------------------------------
+
+std::string describe_error(Error error, uint32_t position, std::string_view expression)
 {
-    Tokens tokens = getTokens(equation);
+    std::string message;
+    if (position < expression.size())
+    {
+        if (error == Error::incorrect_order && describe_token_order(expression, position, message))
+            return message;
+
+        Token token;
+        next_token(expression.data() + position, expression.data() + expression.size(), token);
+        if (error == Error::undefined_variable && token.type == TokType::var)
+            return message.append("Variable ").append(token.text).append(" is not defined.");
+    }
+    return message.append(error_message(error));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+static_assert(std::is_trivially_copyable<Result>::value, "Results are copied as plain memory");
+
+std::string Result::what() const
+{
+    return error_message(error);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Scratch memory of the parsing and the compilation, see Context.
+struct Workspace
+{
+    explicit Workspace(std::pmr::memory_resource* memory)
+        : builder(memory)
+        , compile(memory)
+        , expression(memory)
+    {
+    }
+
     RPN_Builder builder;
+    CompileScratch compile;
+    CompiledExpression expression; // the expression of calculate()
+};
+
+// -------------------------------------------------------------------------------------------------
+
+CompiledExpression::CompiledExpression(std::pmr::memory_resource *memory)
+    : program_(memory)
+    , positions_(memory)
+    , constants_(memory)
+    , variables_(memory)
+{
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool CompiledExpression::ok() const
+{
+    return error_ == Error::none;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Error CompiledExpression::error() const
+{
+    return error_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint32_t CompiledExpression::position() const
+{
+    return position_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+const std::pmr::vector<Instruction>& CompiledExpression::program() const
+{
+    return program_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+const std::pmr::vector<double>& CompiledExpression::constants() const
+{
+    return constants_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+const std::pmr::vector<std::pmr::string>& CompiledExpression::variables() const
+{
+    return variables_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool CompiledExpression::find_variable(const std::string& name, size_t& slot) const
+{
+    auto iter = std::find(variables_.begin(), variables_.end(), std::string_view(name));
+    if (iter == variables_.end())
+        return false;
+
+    slot = static_cast<size_t>(iter - variables_.begin());
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+size_t CompiledExpression::registers() const
+{
+    return registers_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Operand CompiledExpression::result() const
+{
+    return result_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result CompiledExpression::evaluate(const double *values, size_t count) const
+{
+    if (error_ != Error::none)
+        return failure(error_, position_);
+    if (count < variables_.size())
+        return failure(Error::missing_value, 0);
+
+    if (jit_)
+    {
+        if (JitFunction function = jit_->function())
+        {
+            // NaN is returned on division by zero as well, so interpret the expression to tell
+            // one from another.
+            const double result = function(values);
+            if (!std::isnan(result))
+                return {result};
+        }
+        else
+        {
+            jit_->count_evaluation(*this);
+        }
+    }
+
+    // The program never needs more registers than kMaxRegisters, so there are no allocations.
+    double registers[kMaxRegisters];
+    const double* const bases[] = {registers, constants_.data(), values};
+    if (!program_.empty())
+    {
+        const Instruction* begin = program_.data();
+        if (const Instruction* failed = execute(begin, begin + program_.size(), bases))
+            return failure(Error::division_by_zero, positions_[failed - begin]);
+    }
+
+    const double result = bases[result_.kind][result_.index];
+    return {result};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result CompiledExpression::evaluate() const
+{
+    return evaluate(nullptr, 0);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+JitFunction CompiledExpression::native_function() const
+{
+    return jit_ ? jit_->function() : nullptr;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void CompiledExpression::build(std::string_view expression,
+                               const std::vector<std::string> *variables,
+                               const CompileOptions &options,
+                               Workspace &workspace)
+{
+    program_.clear();
+    positions_.clear();
+    constants_.clear();
+    variables_.clear();
+    result_ = Operand{};
+    registers_ = 0;
+    jit_.reset();
+    error_ = Error::none;
+    position_ = 0;
+
+    // Drops the program and keeps the reason of failure.
+    auto fail = [this](Error error, uint32_t position)
+    {
+        program_.clear();
+        positions_.clear();
+        constants_.clear();
+        error_ = error;
+        position_ = position;
+    };
+
+    RPN_Builder& builder = workspace.builder;
     try {
-        if (!builder(tokens)) {
-            return {"Incorrect expression", 0.0, false};
+        // Sanity check.
+        if (!builder(expression)) {
+            fail(builder.error(), builder.position());
+            return;
         }
 
-        std::stack<double> stack;
-        for (const auto& item: builder.reverse_polish_notation()) {
-            std::visit(overloaded{
-                [&stack](Operation arg) { stack.push(::calculate(arg, stack)); },
-                [&stack](double arg) { stack.push(arg); },
-                [&stack](const std::string& arg) { ; }
-            }, item);
+        if (variables != nullptr)
+            variables_.assign(variables->begin(), variables->end());
+
+        // Resolves the variable name to its slot, so the evaluation takes the variable value by
+        // index without any name lookup. Returns false if the variable is not in the given list.
+        auto resolve_slot = [this, variables](std::string_view name, uint32_t& slot)
+        {
+            auto iter = std::find(variables_.begin(), variables_.end(), name);
+            if (iter == variables_.end())
+            {
+                if (variables != nullptr)
+                    return false;
+                iter = variables_.emplace(variables_.end(), name);
+            }
+            slot = static_cast<uint32_t>(iter - variables_.begin());
+            return true;
+        };
+
+        // Lowers reverse Polish notation into the expression tree and checks that every operation
+        // has enough operands, so the evaluation does not need to check it any more.
+        ExpressionTree& tree = workspace.compile.tree;
+        std::pmr::vector<uint32_t>& stack = workspace.compile.stack;
+        auto lower = [&]()
+        {
+            tree.clear();
+            stack.clear();
+            constants_.clear();
+            for (const auto& item: builder.reverse_polish_notation()) {
+                Node node;
+                Error error = Error::none;
+                uint32_t position = 0;
+                std::visit(overloaded{
+                    [&node, &stack, &error, &position](const OperationToken& arg) {
+                        node.code = to_op_code(arg.operation);
+                        node.position = arg.position;
+                        const size_t operands = is_unary(node.code) ? 1 : 2;
+                        if (stack.size() < operands)
+                        {
+                            error = Error::incorrect_expression;
+                            position = arg.position;
+                            return;
+                        }
+                        node.left = stack[stack.size() - operands];
+                        node.right = stack.back();
+                        stack.resize(stack.size() - operands);
+                    },
+                    [this, &node](double arg) {
+                        node.leaf = true;
+                        node.operand = make_operand(Operand::constant,
+                                                    static_cast<uint32_t>(constants_.size()));
+                        constants_.push_back(arg);
+                    },
+                    [this, &node, &error, &position, &resolve_slot, expression](
+                        std::string_view arg) {
+                        uint32_t slot = 0;
+                        if (!resolve_slot(arg, slot))
+                        {
+                            error = Error::undefined_variable;
+                            position = static_cast<uint32_t>(arg.data() - expression.data());
+                            return;
+                        }
+                        node.leaf = true;
+                        node.operand = make_operand(Operand::var, slot);
+                    }
+                }, item);
+                if (error != Error::none)
+                {
+                    fail(error, position);
+                    return false;
+                }
+
+                stack.push_back(static_cast<uint32_t>(tree.size()));
+                tree.push_back(node);
+            }
+            if (stack.size() != 1)
+            {
+                fail(Error::incorrect_expression, 0);
+                return false;
+            }
+            return true;
+        };
+
+        if (!lower())
+            return;
+        if (options.optimize)
+            optimize(tree, constants_, workspace.compile, true);
+        generate_code(tree, program_, positions_, result_, registers_, workspace.compile);
+
+        // A merged node keeps its register until its last parent is evaluated, so the DAG may need
+        // more registers than the tree. Then the expression is lowered again and simplified
+        // without merging, the tree is evaluated within log2(leaves) + 1 registers.
+        if (registers_ > kMaxRegisters && options.optimize)
+        {
+            program_.clear();
+            positions_.clear();
+            lower();
+            optimize(tree, constants_, workspace.compile, false);
+            generate_code(tree, program_, positions_, result_, registers_, workspace.compile);
+        }
+        if (registers_ > kMaxRegisters)
+        {
+            fail(Error::too_complex, 0);
+            return;
+        }
+
+        if (options.jit != JitMode::off && JitCode::supported())
+        {
+            jit_ = std::make_shared<JitTier>(options.jit_threshold);
+            if (options.jit == JitMode::eager || options.jit_threshold == 0)
+                jit_->generate(*this);
         }
-        return {{}, stack.top(), true};
     }
-    catch (const std::exception &e) {
-        return {e.what(), 0.0, false};
+    catch (const std::bad_alloc&) {
+        jit_.reset();
+        fail(Error::out_of_memory, 0);
     }
-    catch (...) {
-        return {"Something went wrong", 0.0, false};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+CompiledExpression compile(const char *equation, const CompileOptions &options)
+{
+    return compile(view_of(equation), options);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+CompiledExpression compile(const char *equation,
+                           const std::vector<std::string> &variables,
+                           const CompileOptions &options)
+{
+    return compile(view_of(equation), variables, options);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+CompiledExpression compile(std::string_view equation, const CompileOptions &options)
+{
+    CompiledExpression expression(memory_or_default(options.memory));
+    Workspace workspace(memory_or_default(options.memory));
+    expression.build(equation, nullptr, options, workspace);
+    return expression;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+CompiledExpression compile(std::string_view equation,
+                           const std::vector<std::string> &variables,
+                           const CompileOptions &options)
+{
+    CompiledExpression expression(memory_or_default(options.memory));
+    Workspace workspace(memory_or_default(options.memory));
+    expression.build(equation, &variables, options, workspace);
+    return expression;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result calculate(const char *equation)
+{
+    return calculate(view_of(equation));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result calculate(std::string_view equation)
+{
+    // Every thread reuses its own context, so calls without a context do not allocate memory
+    // after the warm-up either.
+    thread_local Context context;
+    return calculate(equation, context);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result calculate(const char *equation, Context &context)
+{
+    return calculate(view_of(equation), context);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result calculate(std::string_view equation, Context &context)
+{
+    CompiledExpression& expression = context.workspace_->expression;
+    expression.build(equation, nullptr, CompileOptions{}, *context.workspace_);
+    return expression.evaluate();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Context
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// -------------------------------------------------------------------------------------------------
+
+Context::Context(std::pmr::memory_resource *memory)
+    : workspace_(std::make_unique<Workspace>(memory_or_default(memory)))
+{
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Context::~Context() = default;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Parser stages
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// -------------------------------------------------------------------------------------------------
+
+size_t ParserStages::count_tokens(std::string_view expression)
+{
+    const char* const end = expression.data() + expression.size();
+    size_t count = 0;
+    Token token;
+    for (const char* c = next_token(expression.data(), end, token);
+         token.type != TokType::undefined;
+         c = next_token(c, end, token))
+    {
+        ++count;
     }
+    return count;
 }
 
-} // namespace calc
+// -------------------------------------------------------------------------------------------------
+
+size_t ParserStages::build_reverse_polish_notation(std::string_view expression, Context &context)
+{
+    RPN_Builder& builder = context.workspace_->builder;
+    return builder(expression) ? builder.reverse_polish_notation().size() : 0;
+}
+
+// -------------------------------------------------------------------------------------------------
 
+size_t ParserStages::build_reverse_polish_notation(std::string_view expression)
+{
+    RPN_Builder builder(std::pmr::get_default_resource());
+    return builder(expression) ? builder.reverse_polish_notation().size() : 0;
+}
+
+} // namespace calc
@@ -1,19 +1,258 @@
 #ifndef EQUATION_H
 #define EQUATION_H
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace calc {
 
+// Reasons of failures. Failures are reported with the code, the message is built from the code only
+// when it is asked, so failed evaluations cost no more than successful ones.
+enum class Error : uint8_t
+{
+    none,
+    division_by_zero,
+    incorrect_expression,
+    incorrect_order, // operands and operations are in the wrong order, e.g. "2 + * 3"
+    extra_open_parenthesis,
+    extra_close_parenthesis,
+    no_operands,
+    undefined_variable, // the variable is not in the list given to compile()
+    missing_value, // the values of some variables are not given to the evaluation
+    too_complex, // the expression needs more registers than the evaluation has
+    out_of_memory
+};
+
+// Returns the message describing the failure.
+const char* error_message(Error error);
+
+// Returns the detailed message of the failure of 'expression', e.g. it names the tokens which are
+// in the wrong order. The tokens are found by scanning the expression again, so nothing is paid for
+// the message until it is asked.
+std::string describe_error(Error error, uint32_t position, std::string_view expression);
+
+// Result of the evaluation. It is trivially copyable and takes 16 bytes, so large arrays of results
+// are cheap to keep and to copy.
 struct Result
 {
-    std::string what; // the reason of failure
     double result{0.0};
-    bool ok{true}; // true if no issues happened, otherwise - false
+    uint32_t position{0}; // the offset of the token in the expression which caused the failure
+    Error error{Error::none}; // the reason of failure
+
+    // Returns true if no issues happened, otherwise - false.
+    bool ok() const { return error == Error::none; }
+
+    // Returns the message of the failure, see describe_error() for the detailed one.
+    std::string what() const;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Instruction set of a compiled expression. Every instruction applies the operation to its operands
+// and writes the result to the destination register, unary operations take the operand 'a' only.
+enum class OpCode : uint8_t
+{
+    un_min,
+    add,
+    sub,
+    mul,
+    div,
+    pow,
+    sqrt,
+    recip // 1 / a without the division by zero error, the optimizer lowers a ^ -1 into it
+};
+
+// Operand of an instruction: a register, a constant from the constant pool or a variable slot.
+struct Operand
+{
+    enum Kind : uint32_t
+    {
+        reg,
+        constant,
+        var
+    };
+
+    uint32_t kind : 2;
+    uint32_t index : 30;
+};
+
+struct Instruction
+{
+    OpCode code{OpCode::add};
+    uint32_t dst{0}; // the destination register
+    Operand a{};
+    Operand b{};
+};
+
+// -------------------------------------------------------------------------------------------------
+
+enum class JitMode
+{
+    off, // the expression is always interpreted
+    tiered, // native code is generated after 'jit_threshold' interpreted evaluations
+    eager // native code is generated by compile()
+};
+
+struct CompileOptions
+{
+    // Native code is generated for x86-64 only, other platforms always interpret the expression.
+    JitMode jit{JitMode::off};
+    uint32_t jit_threshold{1000};
+
+    // Folds constants and simplifies the expression, see optimize() in optimizer.h.
+    bool optimize{true};
+
+    // Memory of the compilation. Scratch buffers of the parser and the program, constants and
+    // variable names of the compiled expression are allocated from it, so expressions compiled
+    // from e.g. std::pmr::monotonic_buffer_resource are released at once with the resource. The
+    // resource must outlive the expression, copies of the expression take the default resource.
+    // The default resource is used if it is null.
+    std::pmr::memory_resource *memory{nullptr};
+};
+
+class Context;
+class JitTier;
+struct ParserStages;
+struct Workspace;
+using JitFunction = double (*)(const double *values);
+
+// -------------------------------------------------------------------------------------------------
+
+// Keeps the validated expression compiled to register code, so the expression is parsed only once
+// and then can be evaluated as many times as needed.
+class CompiledExpression
+{
+public:
+    CompiledExpression() = default;
+
+    // Returns true if the expression was compiled successfully.
+    bool ok() const;
+
+    // Returns the code of compilation failure and the offset of the token which caused it,
+    // describe_error() gives the message.
+    Error error() const;
+    uint32_t position() const;
+
+    const std::pmr::vector<Instruction>& program() const;
+
+    // Returns the constant pool of the program.
+    const std::pmr::vector<double>& constants() const;
+
+    // Returns names of the expression variables, the index of a name is the slot of the variable.
+    const std::pmr::vector<std::pmr::string>& variables() const;
+
+    // Finds the slot of the variable, returns false if the expression has no such variable.
+    bool find_variable(const std::string& name, size_t& slot) const;
+
+    // Returns the number of registers used by the program.
+    size_t registers() const;
+
+    // Returns the operand keeping the result when the program is done.
+    Operand result() const;
+
+    // Evaluates the compiled expression. There is no parsing, no allocations and no exceptions
+    // here, failures are reported with the error code. The value of the variable in the slot N is
+    // taken from values[N], 'count' is the number of the given values.
+    Result evaluate(const double *values, size_t count) const;
+
+    // Evaluates the compiled expression which has no variables.
+    Result evaluate() const;
+
+    // Returns the native function of the expression if it is generated, otherwise - null. The
+    // function returns NaN on division by zero, evaluate() tells such results from real NaNs.
+    JitFunction native_function() const;
+
+private:
+    friend CompiledExpression compile(std::string_view equation, const CompileOptions &options);
+    friend CompiledExpression compile(std::string_view equation,
+                                      const std::vector<std::string> &variables,
+                                      const CompileOptions &options);
+    friend Result calculate(std::string_view equation, Context &context);
+    friend struct Workspace;
+
+    explicit CompiledExpression(std::pmr::memory_resource *memory);
+
+    // Compiles the expression, the variables get slots in order of their first appearance if
+    // 'variables' is null. The previous state is dropped, but buffers keep their capacity, so the
+    // expression can be rebuilt without allocations. Temporary buffers are taken from 'workspace'.
+    void build(std::string_view equation,
+               const std::vector<std::string> *variables,
+               const CompileOptions &options,
+               Workspace &workspace);
+
+    std::pmr::vector<Instruction> program_;
+    std::pmr::vector<uint32_t> positions_; // offsets of the instruction operations in the source
+    std::pmr::vector<double> constants_;
+    std::pmr::vector<std::pmr::string> variables_;
+    Operand result_{};
+    size_t registers_{0};
+    std::shared_ptr<JitTier> jit_;
+    Error error_{Error::incorrect_expression};
+    uint32_t position_{0};
 };
 
+// Parses and validates the expression, the returned expression is ready to be evaluated.
+// The variables get slots in order of their first appearance in the expression.
+CompiledExpression compile(const char *equation, const CompileOptions &options = {});
+
+// The same as above, but the variables get slots in order of the given names, the expression
+// fails to compile if it uses a variable which is not in the list.
+CompiledExpression compile(const char *equation,
+                           const std::vector<std::string> &variables,
+                           const CompileOptions &options = {});
+
+// The same as the overloads above, but the expression is the given characters, it does not need
+// the NUL terminator. Positions of failures are offsets in these characters.
+CompiledExpression compile(std::string_view equation, const CompileOptions &options = {});
+CompiledExpression compile(std::string_view equation,
+                           const std::vector<std::string> &variables,
+                           const CompileOptions &options = {});
+
+// -------------------------------------------------------------------------------------------------
+
+// Keeps the scratch memory of calculate(): buffers of the parser, of the compilation and of the
+// compiled expression. Buffers keep their capacity between calls, so calculate() with the reused
+// context does not allocate memory once the buffers have grown enough. The context may be used by
+// one thread at a time.
+class Context
+{
+public:
+    // Buffers are allocated from 'memory', the default resource is used if it is null.
+    explicit Context(std::pmr::memory_resource *memory = nullptr);
+    ~Context();
+
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+private:
+    friend Result calculate(std::string_view equation, Context &context);
+    friend struct ParserStages;
+
+    std::unique_ptr<Workspace> workspace_;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluates the expression without variables. The scratch memory is kept in the context of the
+// calling thread, so repeated calls are as cheap as the calls with a reused context. The context
+// takes the default resource of the first call of the thread and is kept until the thread exits.
 Result calculate(const char *equation);
 
+// The same as above, but all scratch memory is taken from 'context'. Successful calls and failures
+// of the evaluation do not allocate memory after the warm-up.
+Result calculate(const char *equation, Context &context);
+
+// The same as the overloads above, but the expression is the given characters and it does not
+// need the NUL terminator, so expressions are evaluated right in the larger buffer, e.g. in the
+// network buffer or in the line of a mapped file.
+Result calculate(std::string_view equation);
+Result calculate(std::string_view equation, Context &context);
+
 } // // namespace calc
 
 #endif // EQUATION_H
@@ -0,0 +1,190 @@
+#include "equation.h"
+#include "test_support.h"
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+// Checks of the failures: every failure is reported with its code and the offset of the token
+// which caused it, by calculate() and by the compiled expression in every mode. Messages are built
+// from the code and the position only when they are asked.
+
+using namespace calc::test;
+
+namespace {
+
+struct Failure
+{
+    const char* expression;
+    calc::Error error;
+    uint32_t position;
+};
+
+const Failure kFailures[] = {
+    {"", calc::Error::no_operands, 0},
+    {"   ", calc::Error::no_operands, 0},
+    {"(", calc::Error::no_operands, 0},
+    {"-", calc::Error::no_operands, 0},
+    {"sqrt", calc::Error::no_operands, 0},
+    {"1 +", calc::Error::incorrect_expression, 2},
+    {"2 + * 3", calc::Error::incorrect_order, 4},
+    {"* 2", calc::Error::incorrect_order, 0},
+    {")", calc::Error::incorrect_order, 0},
+    {"()", calc::Error::incorrect_order, 1},
+    {"sqrt()", calc::Error::incorrect_order, 5},
+    {"1 2", calc::Error::incorrect_order, 2},
+    {"1 + sqrt 4", calc::Error::incorrect_order, 9},
+    {"2 ^ -1", calc::Error::incorrect_order, 4},
+    {"(1 + 2", calc::Error::extra_open_parenthesis, 0},
+    {"1 * ((2 + 3)", calc::Error::extra_open_parenthesis, 4},
+    {"1 + 2)", calc::Error::extra_close_parenthesis, 5},
+    {"((1)))", calc::Error::extra_close_parenthesis, 5},
+    {"1 / 0", calc::Error::division_by_zero, 2},
+    {"1 + 2 / (3 - 3)", calc::Error::division_by_zero, 6},
+};
+
+// -------------------------------------------------------------------------------------------------
+
+bool same_failure(const calc::Result& result, const Failure& failure)
+{
+    return result.error == failure.error && result.position == failure.position;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_failures()
+{
+    calc::Context context;
+    for (const Failure& failure : kFailures)
+    {
+        const std::string expression = failure.expression;
+        const calc::Result calculated = calc::calculate(failure.expression);
+        check(same_failure(calculated, failure),
+              "\"" + expression + "\" gives " + describe(calculated) + " at "
+              + std::to_string(calculated.position));
+        check(same_failure(calc::calculate(expression, context), failure),
+              "\"" + expression + "\" fails differently with the context");
+
+        for (calc::JitMode jit : {calc::JitMode::off, calc::JitMode::eager})
+        {
+            for (bool optimize : {false, true})
+            {
+                calc::CompileOptions options;
+                options.jit = jit;
+                options.optimize = optimize;
+                const calc::CompiledExpression compiled =
+                    calc::compile(failure.expression, {}, options);
+                check(same_failure(compiled.evaluate(), failure),
+                      "the compiled \"" + expression + "\" gives " + describe(compiled.evaluate())
+                      + " at " + std::to_string(compiled.evaluate().position));
+
+                // Only the evaluation finds the division by zero.
+                check(compiled.ok() == (failure.error == calc::Error::division_by_zero),
+                      "the compilation of \"" + expression + "\" is wrong");
+            }
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_variable_failures()
+{
+    // The undefined variable is found by the compilation, the missing value by the evaluation.
+    const calc::CompiledExpression undefined = calc::compile("a + b * zz", {"a", "b"});
+    check(undefined.error() == calc::Error::undefined_variable && undefined.position() == 8,
+          "\"a + b * zz\" gives " + describe(undefined.evaluate()));
+
+    const calc::CompiledExpression defined = calc::compile("a + b * c", {"a", "b", "c"});
+    const double values[] = {1.0, 2.0, 3.0};
+    check(defined.evaluate(values, 3).result == 7.0 && defined.evaluate(values, 3).ok(),
+          "\"a + b * c\" gives " + describe(defined.evaluate(values, 3)));
+    check(defined.evaluate(values, 2).error == calc::Error::missing_value
+          && defined.evaluate(values, 2).position == 0,
+          "\"a + b * c\" with two values gives " + describe(defined.evaluate(values, 2)));
+
+    // Division by zero in the row of variables is found at the division.
+    const calc::CompiledExpression divided = calc::compile("a * 2 / (b - c)", {"a", "b", "c"});
+    const double zero[] = {1.0, 3.0, 3.0};
+    check(divided.evaluate(zero, 3).error == calc::Error::division_by_zero
+          && divided.evaluate(zero, 3).position == 6,
+          "\"a * 2 / (b - c)\" gives " + describe(divided.evaluate(zero, 3)));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Results are kept in large arrays, so they stay small and trivially copyable.
+static_assert(sizeof(calc::Result) == 16, "calc::Result is not 16 bytes");
+static_assert(std::is_trivially_copyable<calc::Result>::value,
+              "calc::Result is not trivially copyable");
+
+void check_messages()
+{
+    struct Message
+    {
+        const char* expression;
+        const char* text;
+    };
+    const Message kMessages[] = {
+        {"", "Expression does not contain any operands."},
+        {"1 +", "Incorrect expression"},
+        {"2 + * 3", "Incorrect order of operands and operations in the expression.\n"
+                    "The multiplication sign '*' cannot be after the addition sign '+'"},
+        {"* 2", "Incorrect order of operands and operations in the expression.\n"
+                "The multiplication sign '*' cannot be the first in an expression."},
+        {"1 2", "Incorrect order of operands and operations in the expression.\n"
+                "The number 2 cannot be after the number 1"},
+        {"1 + sqrt 4", "Incorrect order of operands and operations in the expression.\n"
+                       "The number 4 cannot be after the sqrt function"},
+        {"sqrt()", "Incorrect order of operands and operations in the expression.\n"
+                   "The close parenthesis cannot be after the open parenthesis"},
+        {"(1 + 2", "Found extra open parentheses."},
+        {"1 + 2)", "Found extra close parentheses."},
+        {"1 / 0", "Divizion on zero is not defined"},
+    };
+    for (const Message& message : kMessages)
+    {
+        const calc::Result result = calc::calculate(message.expression);
+        const std::string text = calc::describe_error(result.error, result.position,
+                                                      message.expression);
+        check(text == message.text,
+              std::string("\"") + message.expression + "\" is described as \"" + text + "\"");
+    }
+
+    // The variable is named by its position.
+    const calc::CompiledExpression undefined = calc::compile("a + b * zz", {"a", "b"});
+    check(calc::describe_error(undefined.error(), undefined.position(), "a + b * zz")
+          == "Variable zz is not defined.", "the undefined variable is not named");
+
+    // what() gives the short message of the code, the successful result has none.
+    const calc::Result failed = calc::calculate("2 + * 3");
+    check(failed.what() == calc::error_message(failed.error)
+          && failed.what() == "Incorrect order of operands and operations in the expression.",
+          "what() gives \"" + failed.what() + "\"");
+    check(calc::calculate("1 + 2").what().empty(), "the successful result has a message");
+    check(calc::describe_error(calc::Error::none, 0, "1 + 2").empty(),
+          "the successful result is described");
+
+    // Every code has its message.
+    for (calc::Error error : {calc::Error::division_by_zero, calc::Error::incorrect_expression,
+                              calc::Error::incorrect_order, calc::Error::extra_open_parenthesis,
+                              calc::Error::extra_close_parenthesis, calc::Error::no_operands,
+                              calc::Error::undefined_variable, calc::Error::missing_value,
+                              calc::Error::too_complex, calc::Error::out_of_memory})
+    {
+        check(std::strlen(calc::error_message(error)) > 0,
+              "the error " + std::to_string(static_cast<int>(error)) + " has no message");
+    }
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_failures();
+    check_variable_failures();
+    check_messages();
+    return finish();
+}
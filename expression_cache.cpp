@@ -0,0 +1,273 @@
+#include "expression_cache.h"
+#include "parser.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+// -------------------------------------------------------------------------------------------------
+
+// Characters are classified like the tokenizer does.
+using calc::is_space;
+using calc::is_symbol;
+
+bool is_word_char(char c)
+{
+    return !is_space(c) && !is_symbol(c);
+}
+
+bool is_exponent_char(char c)
+{
+    return c == 'e' || c == 'E' || c == 'p' || c == 'P';
+}
+
+bool is_sign(char c)
+{
+    return c == '+' || c == '-';
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Scans the normalized form of the expression: emit(c, offset) is called for every character of
+// the form, 'offset' is the offset of the character in 'equation'. Symbols are single character
+// tokens, so spaces next to them do not matter. Spaces are kept as one space between two word
+// characters, which would join two tokens into one, and next to the sign following an exponent
+// character, which would join e.g. "1e" and "+5" into the number 1e+5.
+template<class Emit>
+void scan_normalized(std::string_view equation, Emit emit)
+{
+    char last = '\0';
+    char before_last = '\0';
+    bool space = false;
+    for (size_t offset = 0; offset < equation.size(); ++offset)
+    {
+        const char c = equation[offset];
+        if (is_space(c))
+        {
+            space = last != '\0';
+            continue;
+        }
+
+        if (space)
+        {
+            const bool joins_words = is_word_char(last) && is_word_char(c);
+            const bool joins_exponent = (is_exponent_char(last) && is_sign(c))
+                || (is_exponent_char(before_last) && is_sign(last) && is_word_char(c));
+            if (joins_words || joins_exponent)
+            {
+                emit(' ', offset - 1);
+                before_last = last;
+                last = ' ';
+            }
+            space = false;
+        }
+
+        emit(c, offset);
+        before_last = last;
+        last = c;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void normalize(std::string_view equation, std::string& key)
+{
+    key.clear();
+    scan_normalized(equation, [&key](char c, size_t) { key.push_back(c); });
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Returns true if the failure refers to a token, other failures have the position 0.
+bool refers_to_token(calc::Error error)
+{
+    switch (error)
+    {
+    case calc::Error::none:
+    case calc::Error::no_operands:
+    case calc::Error::missing_value:
+    case calc::Error::too_complex:
+    case calc::Error::out_of_memory:
+        return false;
+    case calc::Error::division_by_zero:
+    case calc::Error::incorrect_expression:
+    case calc::Error::incorrect_order:
+    case calc::Error::extra_open_parenthesis:
+    case calc::Error::extra_close_parenthesis:
+    case calc::Error::undefined_variable:
+        break;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Converts the offset in the normalized form of the expression to the offset in the expression.
+uint32_t original_position(std::string_view equation, uint32_t position)
+{
+    uint32_t normalized = 0;
+    size_t original = equation.size();
+    scan_normalized(equation, [&](char, size_t offset)
+    {
+        if (normalized++ == position)
+            original = offset;
+    });
+    return static_cast<uint32_t>(std::min(original, equation.size()));
+}
+
+} // anonymous namespace
+
+namespace calc {
+
+// -------------------------------------------------------------------------------------------------
+
+std::string normalize_expression(std::string_view equation)
+{
+    std::string key;
+    normalize(equation, key);
+    return key;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Shards do not outnumber the kept expressions, and the capacity is split between them exactly:
+// the first capacity % shards shards keep one expression more.
+ExpressionCache::ExpressionCache(size_t capacity, size_t shards, const CompileOptions &options)
+    : options_(options)
+    , shard_count_(std::max<size_t>(capacity != 0 ? std::min(shards, capacity) : shards, 1))
+    , shards_(std::make_unique<Shard[]>(shard_count_))
+{
+    for (size_t index = 0; index < shard_count_; ++index)
+        shards_[index].capacity = capacity / shard_count_ + (index < capacity % shard_count_);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+ExpressionCache::Shard& ExpressionCache::shard(std::string_view key)
+{
+    return shards_[std::hash<std::string_view>()(key) % shard_count_];
+}
+
+// -------------------------------------------------------------------------------------------------
+
+std::shared_ptr<const CompiledExpression> ExpressionCache::compile(const char *equation)
+{
+    return compile(equation != nullptr ? std::string_view(equation) : std::string_view());
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result ExpressionCache::calculate(const char *equation)
+{
+    return calculate(equation != nullptr ? std::string_view(equation) : std::string_view());
+}
+
+// -------------------------------------------------------------------------------------------------
+
+std::shared_ptr<const CompiledExpression> ExpressionCache::compile(std::string_view equation)
+{
+    // The key is built in the buffer of the thread, so looking up the cached expression does not
+    // allocate memory.
+    thread_local std::string key;
+    normalize(equation, key);
+
+    Shard& shard = this->shard(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(key);
+        if (found != shard.index.end())
+        {
+            ++shard.hits;
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            return found->second->expression;
+        }
+        ++shard.misses;
+    }
+
+    // The expression is compiled without the lock, so other lookups of the shard do not wait
+    // for it. If another thread has compiled the same expression meanwhile, its entry is kept.
+    auto expression = std::make_shared<const CompiledExpression>(calc::compile(key, options_));
+    if (shard.capacity == 0)
+        return expression;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(key);
+    if (found != shard.index.end())
+    {
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        return found->second->expression;
+    }
+
+    if (shard.entries.size() >= shard.capacity)
+    {
+        shard.index.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+    }
+    shard.entries.push_front({key, expression});
+    shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+    return expression;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+Result ExpressionCache::calculate(std::string_view equation)
+{
+    Result result = compile(equation)->evaluate();
+    if (refers_to_token(result.error))
+        result.position = original_position(equation, result.position);
+    return result;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint64_t ExpressionCache::hits() const
+{
+    uint64_t hits = 0;
+    for (size_t index = 0; index < shard_count_; ++index)
+    {
+        std::lock_guard<std::mutex> lock(shards_[index].mutex);
+        hits += shards_[index].hits;
+    }
+    return hits;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint64_t ExpressionCache::misses() const
+{
+    uint64_t misses = 0;
+    for (size_t index = 0; index < shard_count_; ++index)
+    {
+        std::lock_guard<std::mutex> lock(shards_[index].mutex);
+        misses += shards_[index].misses;
+    }
+    return misses;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+size_t ExpressionCache::size() const
+{
+    size_t size = 0;
+    for (size_t index = 0; index < shard_count_; ++index)
+    {
+        std::lock_guard<std::mutex> lock(shards_[index].mutex);
+        size += shards_[index].entries.size();
+    }
+    return size;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void ExpressionCache::clear()
+{
+    for (size_t index = 0; index < shard_count_; ++index)
+    {
+        std::lock_guard<std::mutex> lock(shards_[index].mutex);
+        shards_[index].index.clear();
+        shards_[index].entries.clear();
+    }
+}
+
+} // namespace calc
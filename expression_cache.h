@@ -0,0 +1,97 @@
+#ifndef EXPRESSION_CACHE_H
+#define EXPRESSION_CACHE_H
+
+#include "equation.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace calc {
+
+// Returns the form of the expression which does not depend on spaces: spaces are dropped unless
+// they separate tokens, e.g. "1 + 2" and "1+2" give "1+2", but "1 2" gives "1 2". Expressions with
+// the same normalized form are compiled to the same program.
+std::string normalize_expression(std::string_view equation);
+
+// -------------------------------------------------------------------------------------------------
+
+// Thread-safe LRU cache of compiled expressions keyed by the normalized expression text, so the
+// expression submitted again is not parsed again.
+//
+// Entries are split between shards by the hash of the key, every shard has its own lock and its
+// own LRU list, so threads looking up different expressions rarely wait for each other. Failed
+// compilations are cached too, they fail the same way every time.
+class ExpressionCache
+{
+public:
+    // 'capacity' is the number of kept expressions, it is split evenly between 'shards', zero
+    // disables caching. There are at most 'capacity' shards. Expressions are compiled with
+    // 'options'. Their memory resource is used by several threads without a lock: expressions
+    // are compiled by the threads looking them up and released by the thread dropping the last
+    // reference. So the resource must be thread-safe, e.g. the default one or
+    // std::pmr::synchronized_pool_resource, but not std::pmr::monotonic_buffer_resource, and it
+    // must outlive all expressions returned by the cache.
+    explicit ExpressionCache(size_t capacity = 1024,
+                             size_t shards = 16,
+                             const CompileOptions &options = {});
+
+    ExpressionCache(const ExpressionCache&) = delete;
+    ExpressionCache& operator=(const ExpressionCache&) = delete;
+
+    // Returns the compiled expression, it is compiled if it is not in the cache. The expression
+    // stays valid after it is evicted. Positions of its failures refer to the normalized text.
+    std::shared_ptr<const CompiledExpression> compile(const char *equation);
+
+    // Evaluates the expression without variables. Positions of failures refer to 'equation'.
+    Result calculate(const char *equation);
+
+    // The same as above, but the expression does not need the NUL terminator. The key is built
+    // from the given characters, so they are not copied unless the expression is compiled.
+    std::shared_ptr<const CompiledExpression> compile(std::string_view equation);
+    Result calculate(std::string_view equation);
+
+    // Returns the number of lookups which found the expression and which compiled it.
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+    // Returns the number of kept expressions.
+    size_t size() const;
+
+    // Drops all expressions, the counters are kept.
+    void clear();
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::shared_ptr<const CompiledExpression> expression;
+    };
+
+    // Part of the cache with its own lock, the most recently used entry is the first in the list.
+    // The index refers to the keys kept in the list.
+    struct alignas(64) Shard
+    {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+        size_t capacity{0}; // the number of entries kept by the shard
+        uint64_t hits{0};
+        uint64_t misses{0};
+    };
+
+    Shard& shard(std::string_view key);
+
+    CompileOptions options_;
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+};
+
+} // namespace calc
+
+#endif // EXPRESSION_CACHE_H
@@ -0,0 +1,194 @@
+#include "equation.h"
+#include "expression_cache.h"
+#include "test_support.h"
+
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Checks of the expression cache: expressions which differ only by spaces share one entry, the
+// cache keeps exactly its capacity, drops the least recently used entries and reports failures at
+// positions of the original text.
+
+using namespace calc::test;
+
+namespace {
+
+void check_normalize()
+{
+    struct Normalized
+    {
+        const char* expression;
+        const char* key;
+    };
+    const Normalized kNormalized[] = {
+        {"1 + 2", "1+2"},
+        {"  1+2\t", "1+2"},
+        {"1\t-\r\n2", "1-2"},
+        {"sqrt ( 4 ) * x", "sqrt(4)*x"},
+        {"1 2", "1 2"},
+        {"a   b", "a b"},
+        {"- ( 1 )", "-(1)"},
+        {"", ""},
+        {"   ", ""},
+    };
+    for (const Normalized& normalized : kNormalized)
+    {
+        const std::string key = calc::normalize_expression(normalized.expression);
+        check(key == normalized.key, std::string("\"") + normalized.expression
+                                     + "\" is normalized to \"" + key + "\"");
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_capacity()
+{
+    struct Capacity
+    {
+        size_t capacity;
+        size_t shards;
+    };
+    const Capacity kCapacities[] = {{10, 16}, {1, 16}, {17, 4}, {100, 16}, {1024, 16}, {5, 1}};
+    for (const Capacity& capacity : kCapacities)
+    {
+        calc::ExpressionCache cache(capacity.capacity, capacity.shards);
+        for (size_t index = 0; index < 4 * capacity.capacity + 100; ++index)
+            cache.compile(std::to_string(index) + " + 1");
+        check(cache.size() == capacity.capacity,
+              "the cache of " + std::to_string(capacity.capacity) + " in "
+              + std::to_string(capacity.shards) + " shards keeps " + std::to_string(cache.size()));
+    }
+
+    // Zero capacity disables caching, but the expressions are still compiled.
+    calc::ExpressionCache disabled(0);
+    check(disabled.calculate("1 + 2").result == 3.0 && disabled.calculate("1 + 2").ok()
+          && disabled.size() == 0, "the disabled cache keeps expressions");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_lookups()
+{
+    calc::ExpressionCache cache(2, 1);
+
+    // Spaces do not matter, the same expression is returned.
+    const auto first = cache.compile("1 + 2");
+    const auto second = cache.compile("1+2");
+    check(first == second && cache.hits() == 1 && cache.misses() == 1,
+          "\"1 + 2\" and \"1+2\" are compiled twice");
+
+    // The least recently used expression is dropped.
+    cache.compile("3 * 4");
+    cache.compile("1 + 2");
+    cache.compile("5 - 6");
+    check(cache.hits() == 2 && cache.misses() == 3, "the lookups are counted wrong");
+    cache.compile("1 + 2");
+    check(cache.hits() == 3, "the recently used expression is dropped");
+    cache.compile("3 * 4");
+    check(cache.misses() == 4, "the least recently used expression is kept");
+
+    // The dropped expression stays valid.
+    check(first->evaluate().result == 3.0, "the dropped expression is released");
+
+    // Failed compilations are cached too.
+    cache.clear();
+    check(cache.size() == 0 && cache.hits() == 3, "clear() drops the counters or keeps entries");
+    cache.calculate("1 + * 2");
+    const calc::Result failed = cache.calculate("1 + * 2");
+    check(failed.error == calc::Error::incorrect_order && cache.hits() == 4,
+          "the failed expression is compiled again");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Inserts spaces between characters of the expression where they do not join two tokens.
+std::string spread(const std::string& expression, std::mt19937& random)
+{
+    std::string spread;
+    for (char c : expression)
+    {
+        spread += c;
+        const int spaces = static_cast<int>(random() % 4);
+        if (c == '(' || c == ')' || c == '+' || c == '*' || c == '/' || c == '^' || c == '-')
+            spread.append(static_cast<size_t>(spaces), ' ');
+    }
+    return spread;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Failures are reported at the position of the original text, as calculate() reports them.
+void check_positions()
+{
+    const char* const kFailed[] = {
+        "  2 +   * 3", "1 +   2)", "(  1 + 2", "1 /  ( 2 - 2 )", "1 2", "\t\t1 +", "x  +  1",
+        "sqrt  (  )", "1 + sqrt   4", "  (1 + 2) * ((3)",
+    };
+
+    calc::ExpressionCache cache;
+    std::mt19937 random(19);
+    for (const char* failed : kFailed)
+    {
+        for (const std::string& expression : {std::string(failed), spread(failed, random)})
+        {
+            // The first lookup compiles the expression, the second one finds it.
+            for (int lookup = 0; lookup < 2; ++lookup)
+            {
+                const calc::Result result = cache.calculate(expression);
+                const calc::Result expected = calc::calculate(expression);
+                check(result.error == expected.error && result.position == expected.position,
+                      "\"" + expression + "\" fails at " + std::to_string(result.position)
+                      + " instead of " + std::to_string(expected.position));
+            }
+        }
+    }
+
+    // The expression found by another text is reported at the position of the given one.
+    cache.calculate("1+*2");
+    const calc::Result result = cache.calculate("1   +   *   2");
+    check(result.position == 8, "\"1   +   *   2\" fails at " + std::to_string(result.position));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_threads()
+{
+    calc::ExpressionCache cache(64, 4);
+    std::vector<std::thread> threads;
+    std::vector<int> wrong(4, 0);
+    for (size_t thread = 0; thread < wrong.size(); ++thread)
+    {
+        threads.emplace_back([&cache, &wrong, thread]()
+        {
+            for (int index = 0; index < 20000; ++index)
+            {
+                const int term = (index * 7 + static_cast<int>(thread)) % 100;
+                const std::string expression = std::to_string(term) + " * 2";
+                wrong[thread] += cache.calculate(expression).result != term * 2.0;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (int count : wrong)
+        check(count == 0, std::to_string(count) + " concurrent lookups give wrong results");
+    check(cache.size() == 64 && cache.hits() + cache.misses() == 80000,
+          "concurrent lookups are counted wrong");
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_normalize();
+    check_capacity();
+    check_lookups();
+    check_positions();
+    check_threads();
+    return finish();
+}
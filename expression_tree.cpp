@@ -0,0 +1,137 @@
+#include "expression_tree.h"
+
+#include <algorithm>
+
+namespace calc {
+
+// -------------------------------------------------------------------------------------------------
+
+void generate_code(const ExpressionTree &tree,
+                   std::pmr::vector<Instruction> &program,
+                   std::pmr::vector<uint32_t> &positions,
+                   Operand &result,
+                   size_t &registers,
+                   CompileScratch &scratch)
+{
+    // Count registers every node needs, leaves are used as operands directly and need nothing.
+    std::pmr::vector<uint32_t>& need = scratch.need;
+    need.assign(tree.size(), 0);
+    for (size_t index = 0; index < tree.size(); ++index)
+    {
+        const Node& node = tree[index];
+        if (node.leaf)
+            continue;
+
+        if (is_unary(node.code) || node.left == node.right)
+        {
+            need[index] = std::max<uint32_t>(need[node.left], 1);
+        }
+        else
+        {
+            const uint32_t left = need[node.left];
+            const uint32_t right = need[node.right];
+            need[index] = left == right ? left + 1 : std::max(left, right);
+        }
+    }
+
+    // Count parents of every node, the register of the node is released when its last parent is
+    // evaluated. The root is used by the result, so its register is never released.
+    std::pmr::vector<uint32_t>& users = scratch.users;
+    users.assign(tree.size(), 0);
+    users.back() = 1;
+    for (const Node& node : tree)
+    {
+        if (node.leaf)
+            continue;
+        ++users[node.left];
+        if (node.right != node.left)
+            ++users[node.right];
+    }
+
+    // The value of every evaluated node, the register of the node or the operand of the leaf.
+    std::pmr::vector<Operand>& values = scratch.values;
+    std::pmr::vector<uint8_t>& evaluated = scratch.evaluated;
+    std::pmr::vector<uint8_t>& busy = scratch.busy; // 1 if the register keeps a needed value
+    values.assign(tree.size(), Operand{});
+    evaluated.assign(tree.size(), 0);
+    busy.clear();
+
+    // Releases the register of the operand node if the node is used for the last time.
+    auto release = [&tree, &users, &values, &busy](uint32_t index)
+    {
+        if (!tree[index].leaf && --users[index] == 0)
+            busy[values[index].index] = 0;
+    };
+
+    // Takes the free register with the least index.
+    auto allocate = [&busy]()
+    {
+        const auto free = std::find(busy.begin(), busy.end(), 0);
+        const uint32_t index = static_cast<uint32_t>(free - busy.begin());
+        if (free == busy.end())
+            busy.push_back(1);
+        else
+            *free = 1;
+        return index;
+    };
+
+    // Walk the tree depth first with an explicit stack, so long expressions do not overflow the
+    // native one.
+    using Frame = CompileScratch::Frame;
+
+    std::pmr::vector<Frame>& frames = scratch.frames;
+    frames.clear();
+    frames.push_back({static_cast<uint32_t>(tree.size() - 1), false});
+
+    while (!frames.empty())
+    {
+        const Frame frame = frames.back();
+        const Node& node = tree[frame.node];
+        if (node.leaf || evaluated[frame.node])
+        {
+            if (node.leaf)
+                values[frame.node] = node.operand;
+            frames.pop_back();
+            continue;
+        }
+
+        if (!frame.expanded)
+        {
+            frames.back().expanded = true;
+            if (is_unary(node.code) || node.left == node.right)
+            {
+                frames.push_back({node.left, false});
+                continue;
+            }
+
+            // The heavier child keeps its result in a register while the other one is evaluated.
+            const bool left_first = need[node.left] >= need[node.right];
+            const uint32_t first = left_first ? node.left : node.right;
+            const uint32_t second = left_first ? node.right : node.left;
+            frames.push_back({second, false});
+            frames.push_back({first, false});
+            continue;
+        }
+
+        frames.pop_back();
+        release(node.left);
+        if (node.right != node.left)
+            release(node.right);
+
+        Instruction instruction;
+        instruction.code = node.code;
+        instruction.dst = allocate();
+        instruction.a = values[node.left];
+        instruction.b = values[node.right];
+        program.push_back(instruction);
+        positions.push_back(node.position);
+
+        values[frame.node] = make_operand(Operand::reg, instruction.dst);
+        evaluated[frame.node] = 1;
+    }
+
+    registers = busy.size();
+    result = values.back();
+}
+
+} // namespace calc
@@ -0,0 +1,119 @@
+#ifndef EXPRESSION_TREE_H
+#define EXPRESSION_TREE_H
+
+#include "equation.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace calc {
+
+// -------------------------------------------------------------------------------------------------
+
+// Node of the expression tree. Leaves keep their operand - a constant or a variable, other nodes
+// keep the operation and indices of their children. Unary operations have the same left and right
+// child, binary operations may have the same child too, e.g. x * x, then it is evaluated once.
+struct Node
+{
+    OpCode code{OpCode::add};
+    bool leaf{false};
+    Operand operand{};
+    uint32_t left{0};
+    uint32_t right{0};
+    uint32_t position{0}; // the offset of the operation in the expression
+};
+
+// Expression tree kept in post order: children always precede their parents and the root is the
+// last node. Reverse Polish notation has exactly this order, so the tree is built from it with a
+// plain loop. optimize() merges equal subtrees, then a node may have several parents and the tree
+// becomes a DAG in the same order.
+using ExpressionTree = std::pmr::vector<Node>;
+
+// -------------------------------------------------------------------------------------------------
+
+inline bool is_unary(OpCode code)
+{
+    return code == OpCode::un_min || code == OpCode::sqrt || code == OpCode::recip;
+}
+
+inline Operand make_operand(Operand::Kind kind, uint32_t index)
+{
+    Operand operand{};
+    operand.kind = kind;
+    operand.index = index;
+    return operand;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Scratch memory of the compilation. Buffers keep their capacity between compilations, so the
+// reused scratch does not allocate memory once it has grown enough.
+struct CompileScratch
+{
+    explicit CompileScratch(std::pmr::memory_resource *memory)
+        : tree(memory)
+        , stack(memory)
+        , simplified(memory)
+        , pool(memory)
+        , mapped(memory)
+        , used(memory)
+        , table(memory)
+        , need(memory)
+        , users(memory)
+        , values(memory)
+        , evaluated(memory)
+        , busy(memory)
+        , frames(memory)
+    {
+    }
+
+    // Frame of the depth first walk of the code generation.
+    struct Frame
+    {
+        uint32_t node;
+        bool expanded;
+    };
+
+    ExpressionTree tree; // the tree built from reverse Polish notation
+    std::pmr::vector<uint32_t> stack; // the operand stack of building the tree
+
+    // Buffers of optimize().
+    ExpressionTree simplified;
+    std::pmr::vector<double> pool;
+    std::pmr::vector<uint32_t> mapped;
+    std::pmr::vector<uint8_t> used;
+    std::pmr::vector<uint32_t> table; // the hash table of the simplified nodes
+
+    // Buffers of generate_code().
+    std::pmr::vector<uint32_t> need;
+    std::pmr::vector<uint32_t> users;
+    std::pmr::vector<Operand> values;
+    std::pmr::vector<uint8_t> evaluated;
+    std::pmr::vector<uint8_t> busy;
+    std::pmr::vector<Frame> frames;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Generates register code of the non-empty tree. The result of the expression is left in 'result',
+// which is a constant or a variable if the tree has no operations. 'registers' gets the number of
+// registers used by the program. 'program' is appended, 'positions' gets the offsets of the
+// instruction operations in the expression, 'scratch' keeps the temporary buffers.
+//
+// Children are evaluated in Sethi-Ullman order: the child which needs more registers is evaluated
+// first, so the program of a tree needs at most log2(leaves) + 1 registers. A node with several
+// parents is evaluated once, its register is kept until the last parent is evaluated, so there is
+// no such bound for a DAG: every shared node may hold a register at once. Registers are released
+// before the destination is allocated, so an instruction may write the register of its operand.
+void generate_code(const ExpressionTree &tree,
+                   std::pmr::vector<Instruction> &program,
+                   std::pmr::vector<uint32_t> &positions,
+                   Operand &result,
+                   size_t &registers,
+                   CompileScratch &scratch);
+
+} // namespace calc
+
+#endif // EXPRESSION_TREE_H
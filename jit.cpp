@@ -0,0 +1,398 @@
+#include "jit.h"
+#include "equation.h"
+#include "power.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define CALC_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef CALC_JIT_X86_64
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Assembler
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// -------------------------------------------------------------------------------------------------
+
+// Memory operand of an SSE2 instruction. Registers of the expression are kept in the stack frame,
+// variables are addressed by rbx which keeps the pointer to the variable values and constants are
+// placed into the data area following the code, they are addressed relative to rip.
+struct Memory
+{
+    enum Base
+    {
+        frame,
+        vars,
+        data
+    };
+
+    Base base;
+    int32_t offset;
+};
+
+// Offsets of the data area, constants of the expression follow them.
+constexpr int32_t kSignMaskOffset = 0; // 16 bytes with sign bits for xorpd
+constexpr int32_t kNanOffset = 16;
+constexpr int32_t kOneOffset = 24;
+constexpr int32_t kConstantsOffset = 32;
+
+// Opcodes of scalar double SSE2 instructions, they follow the 0xF2 0x0F prefix.
+constexpr uint8_t kMovsdLoad = 0x10;
+constexpr uint8_t kMovsdStore = 0x11;
+constexpr uint8_t kSqrtsd = 0x51;
+constexpr uint8_t kAddsd = 0x58;
+constexpr uint8_t kMulsd = 0x59;
+constexpr uint8_t kSubsd = 0x5C;
+constexpr uint8_t kDivsd = 0x5E;
+
+// -------------------------------------------------------------------------------------------------
+
+// Emits the machine code of x86-64 System V functions working with scalar doubles.
+class Assembler
+{
+public:
+    const std::vector<uint8_t>& code() const
+    {
+        return code_;
+    }
+
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        code_.insert(code_.end(), values);
+    }
+
+    void int32(int32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+            code_.push_back(static_cast<uint8_t>(static_cast<uint32_t>(value) >> shift));
+    }
+
+    void int64(uint64_t value)
+    {
+        for (int shift = 0; shift < 64; shift += 8)
+            code_.push_back(static_cast<uint8_t>(value >> shift));
+    }
+
+    // Emits the SSE instruction 'prefix 0F opcode' with an xmm register and a memory operand.
+    void sse(uint8_t prefix, uint8_t opcode, int xmm, Memory memory)
+    {
+        bytes({prefix, 0x0F, opcode});
+        const uint8_t reg = static_cast<uint8_t>(xmm << 3);
+        switch (memory.base)
+        {
+        case Memory::frame:
+            bytes({static_cast<uint8_t>(0x84 | reg), 0x24}); // [rsp + disp32]
+            int32(memory.offset);
+            break;
+        case Memory::vars:
+            bytes({static_cast<uint8_t>(0x83 | reg)}); // [rbx + disp32]
+            int32(memory.offset);
+            break;
+        case Memory::data:
+            bytes({static_cast<uint8_t>(0x05 | reg)}); // [rip + disp32]
+            data_fixups_.push_back({code_.size(), memory.offset});
+            int32(0);
+            break;
+        }
+    }
+
+    // Emits 'je rel32' to the error exit.
+    void je_error()
+    {
+        bytes({0x0F, 0x84});
+        error_fixups_.push_back(code_.size());
+        int32(0);
+    }
+
+    // Marks the current position as the error exit.
+    void bind_error()
+    {
+        for (size_t position : error_fixups_)
+            patch(position, static_cast<int32_t>(code_.size() - (position + 4)));
+    }
+
+    // Appends the data area after the code and resolves rip-relative operands.
+    void place_data(const std::vector<uint8_t>& data)
+    {
+        while (code_.size() % 16 != 0)
+            code_.push_back(0xCC); // int3
+        const size_t data_start = code_.size();
+        code_.insert(code_.end(), data.begin(), data.end());
+
+        for (const auto& fixup : data_fixups_)
+        {
+            const size_t target = data_start + static_cast<size_t>(fixup.offset);
+            patch(fixup.position, static_cast<int32_t>(target - (fixup.position + 4)));
+        }
+    }
+
+private:
+    struct DataFixup
+    {
+        size_t position;
+        int32_t offset;
+    };
+
+    void patch(size_t position, int32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+            code_[position++] = static_cast<uint8_t>(static_cast<uint32_t>(value) >> shift);
+    }
+
+    std::vector<uint8_t> code_;
+    std::vector<DataFixup> data_fixups_;
+    std::vector<size_t> error_fixups_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Code generator
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// -------------------------------------------------------------------------------------------------
+
+Memory operand_memory(calc::Operand operand)
+{
+    const int32_t offset = static_cast<int32_t>(operand.index) * 8;
+    switch (operand.kind)
+    {
+    case calc::Operand::reg:
+        return {Memory::frame, offset};
+    case calc::Operand::constant:
+        return {Memory::data, kConstantsOffset + offset};
+    }
+    return {Memory::vars, offset};
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool is_register(calc::Operand operand, int64_t index)
+{
+    return operand.kind == calc::Operand::reg && static_cast<int64_t>(operand.index) == index;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Translates the register code of the expression into a native function. Every instruction loads
+// its first operand into xmm0, applies the operation with the second operand taken from memory and
+// stores xmm0 into the destination register, the load is skipped if xmm0 already keeps the value.
+std::vector<uint8_t> translate(const calc::CompiledExpression& expression)
+{
+    using calc::OpCode;
+
+    Assembler as;
+    const int32_t frame_size = static_cast<int32_t>((expression.registers() * 8 + 15) / 16 * 16);
+
+    // Prologue: rsp is 16 bytes aligned after 'push rbx', so calls of pow() are aligned too.
+    as.bytes({0x53});             // push rbx
+    as.bytes({0x48, 0x89, 0xFB}); // mov rbx, rdi
+    as.bytes({0x48, 0x81, 0xEC}); // sub rsp, frame_size
+    as.int32(frame_size);
+
+    int64_t xmm0_register = -1; // the register of the expression kept in xmm0
+    for (const calc::Instruction& instruction : expression.program())
+    {
+        const Memory a = operand_memory(instruction.a);
+        const Memory b = operand_memory(instruction.b);
+        const bool a_loaded = is_register(instruction.a, xmm0_register);
+
+        switch (instruction.code)
+        {
+        case OpCode::un_min:
+            if (!a_loaded)
+                as.sse(0xF2, kMovsdLoad, 0, a);
+            as.sse(0x66, 0x57, 0, {Memory::data, kSignMaskOffset}); // xorpd xmm0, sign
+            break;
+        case OpCode::sqrt:
+            as.sse(0xF2, kSqrtsd, 0, a);
+            break;
+        case OpCode::recip:
+            as.sse(0xF2, kMovsdLoad, 1, a);
+            as.sse(0xF2, kMovsdLoad, 0, {Memory::data, kOneOffset});
+            as.bytes({0xF2, 0x0F, kDivsd, 0xC1}); // divsd xmm0, xmm1
+            break;
+        case OpCode::add:
+        case OpCode::sub:
+        case OpCode::mul:
+            if (!a_loaded)
+                as.sse(0xF2, kMovsdLoad, 0, a);
+            as.sse(0xF2,
+                   instruction.code == OpCode::add ? kAddsd
+                   : instruction.code == OpCode::sub ? kSubsd : kMulsd,
+                   0, b);
+            break;
+        case OpCode::div:
+            as.sse(0xF2, kMovsdLoad, 1, b);
+            as.bytes({0x66, 0x0F, 0x57, 0xD2}); // xorpd xmm2, xmm2
+            as.bytes({0x66, 0x0F, 0x2E, 0xCA}); // ucomisd xmm1, xmm2
+            as.bytes({0x7A, 0x06});             // jp over je, NaN is not zero
+            as.je_error();
+            if (!a_loaded)
+                as.sse(0xF2, kMovsdLoad, 0, a);
+            as.bytes({0xF2, 0x0F, kDivsd, 0xC1}); // divsd xmm0, xmm1
+            break;
+        case OpCode::pow:
+            if (!a_loaded)
+                as.sse(0xF2, kMovsdLoad, 0, a);
+            as.sse(0xF2, kMovsdLoad, 1, b);
+            as.bytes({0x48, 0xB8}); // mov rax, calc::power
+            as.int64(reinterpret_cast<uint64_t>(&calc::power));
+            as.bytes({0xFF, 0xD0}); // call rax
+            break;
+        }
+
+        as.sse(0xF2, kMovsdStore, 0, {Memory::frame, static_cast<int32_t>(instruction.dst) * 8});
+        xmm0_register = instruction.dst;
+    }
+
+    if (!is_register(expression.result(), xmm0_register))
+        as.sse(0xF2, kMovsdLoad, 0, operand_memory(expression.result()));
+
+    auto epilogue = [&as, frame_size]()
+    {
+        as.bytes({0x48, 0x81, 0xC4}); // add rsp, frame_size
+        as.int32(frame_size);
+        as.bytes({0x5B});             // pop rbx
+        as.bytes({0xC3});             // ret
+    };
+    epilogue();
+
+    // Division by zero returns NaN.
+    as.bind_error();
+    as.sse(0xF2, kMovsdLoad, 0, {Memory::data, kNanOffset});
+    epilogue();
+
+    std::vector<uint8_t> data(kConstantsOffset + expression.constants().size() * 8);
+    const uint64_t sign = 0x8000000000000000ULL;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double one = 1.0;
+    std::memcpy(&data[kSignMaskOffset], &sign, 8);
+    std::memcpy(&data[kSignMaskOffset + 8], &sign, 8);
+    std::memcpy(&data[kNanOffset], &nan, 8);
+    std::memcpy(&data[kOneOffset], &one, 8);
+    if (!expression.constants().empty())
+    {
+        std::memcpy(&data[kConstantsOffset], expression.constants().data(),
+                    expression.constants().size() * 8);
+    }
+    as.place_data(data);
+
+    return as.code();
+}
+
+#endif // CALC_JIT_X86_64
+
+} // anonymous namespace
+
+namespace calc {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      JitCode
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// -------------------------------------------------------------------------------------------------
+
+bool JitCode::supported()
+{
+#ifdef CALC_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+
+std::unique_ptr<JitCode> JitCode::generate(const CompiledExpression &expression)
+{
+#ifdef CALC_JIT_X86_64
+    if (!expression.ok())
+        return nullptr;
+
+    const std::vector<uint8_t> code = translate(expression);
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t size = (code.size() + page - 1) / page * page;
+
+    // The memory is never writable and executable at the same time.
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        return nullptr;
+    }
+
+    return std::unique_ptr<JitCode>(new JitCode(memory, size));
+#else
+    (void)expression;
+    return nullptr;
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+
+JitCode::JitCode(void *memory, size_t size)
+    : memory_(memory)
+    , size_(size)
+{
+}
+
+// -------------------------------------------------------------------------------------------------
+
+JitCode::~JitCode()
+{
+#ifdef CALC_JIT_X86_64
+    munmap(memory_, size_);
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+
+JitFunction JitCode::function() const
+{
+    return reinterpret_cast<JitFunction>(memory_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      JitTier
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// -------------------------------------------------------------------------------------------------
+
+JitTier::JitTier(uint32_t threshold)
+    : threshold_(threshold)
+{
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void JitTier::generate(const CompiledExpression &expression)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (code_)
+        return;
+
+    code_ = JitCode::generate(expression);
+    if (code_)
+        function_.store(code_->function(), std::memory_order_release);
+}
+
+} // namespace calc
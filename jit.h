@@ -0,0 +1,81 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace calc {
+
+class CompiledExpression;
+
+// Native function of a compiled expression. It takes the values of the variables by their slots
+// and returns NaN on division by zero.
+using JitFunction = double (*)(const double *values);
+
+// -------------------------------------------------------------------------------------------------
+
+// Native x86-64 code of a compiled expression kept in its own executable memory pages.
+class JitCode
+{
+public:
+    // Returns true if native code can be generated on this platform.
+    static bool supported();
+
+    // Generates native code of the successfully compiled expression. Returns null if the platform
+    // is not supported or executable memory cannot be allocated.
+    static std::unique_ptr<JitCode> generate(const CompiledExpression &expression);
+
+    ~JitCode();
+
+    JitCode(const JitCode&) = delete;
+    JitCode& operator=(const JitCode&) = delete;
+
+    JitFunction function() const;
+
+private:
+    JitCode(void *memory, size_t size);
+
+    void *memory_;
+    size_t size_;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// State of the tiered compilation shared by copies of a compiled expression. The expression is
+// interpreted until it is evaluated 'threshold' times, then its native code is generated.
+class JitTier
+{
+public:
+    explicit JitTier(uint32_t threshold);
+
+    // Returns the native function or null if it is not generated yet.
+    JitFunction function() const
+    {
+        return function_.load(std::memory_order_acquire);
+    }
+
+    // Counts an interpreted evaluation and generates native code when the threshold is reached.
+    void count_evaluation(const CompiledExpression &expression)
+    {
+        if (evaluations_.fetch_add(1, std::memory_order_relaxed) + 1 == threshold_)
+            generate(expression);
+    }
+
+    // Generates native code at once, does nothing if it is already generated.
+    void generate(const CompiledExpression &expression);
+
+private:
+    std::atomic<JitFunction> function_{nullptr};
+    std::atomic<uint32_t> evaluations_{0};
+    uint32_t threshold_;
+
+    std::mutex mutex_;
+    std::unique_ptr<JitCode> code_;
+};
+
+} // namespace calc
+
+#endif // JIT_H
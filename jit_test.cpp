@@ -0,0 +1,105 @@
+#include "equation.h"
+#include "jit.h"
+#include "test_support.h"
+
+#include <string>
+#include <vector>
+
+// Checks of the native code: random expressions are evaluated by the interpreter, which is the
+// reference, and by the native code of the same program, the results are compared bit for bit.
+// Where native code is not supported, the expression must keep working interpreted.
+
+using namespace calc::test;
+
+namespace {
+
+const std::vector<std::string> kVariables = {"a", "b", "c"};
+
+calc::CompileOptions options_of(calc::JitMode jit, bool optimize)
+{
+    calc::CompileOptions options;
+    options.jit = jit;
+    options.optimize = optimize;
+    return options;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_differential()
+{
+    constexpr int kExpressions = 3000;
+    constexpr size_t kRows = 64;
+
+    ExpressionGenerator generate(8);
+    for (int index = 0; index < kExpressions; ++index)
+    {
+        const std::string expression = generate(6);
+        for (bool optimize : {false, true})
+        {
+            const calc::CompiledExpression interpreted = calc::compile(
+                expression.c_str(), kVariables, options_of(calc::JitMode::off, optimize));
+            const calc::CompiledExpression native = calc::compile(
+                expression.c_str(), kVariables, options_of(calc::JitMode::eager, optimize));
+            if (!interpreted.ok() || !native.ok())
+            {
+                fail("\"" + expression + "\" is not compiled");
+                continue;
+            }
+            check((native.native_function() != nullptr) == calc::JitCode::supported(),
+                  "\"" + expression + "\" has no native code");
+
+            for (size_t row = 0; row < kRows; ++row)
+            {
+                const double values[] = {generate.value(), generate.value(), generate.value()};
+                const calc::Result reference = interpreted.evaluate(values, 3);
+                const calc::Result result = native.evaluate(values, 3);
+                if (!same_result(result, reference, expression))
+                {
+                    fail("\"" + expression + "\" row " + std::to_string(row) + " gives "
+                         + describe(result) + " instead of " + describe(reference));
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_tiers()
+{
+    // The expression is interpreted until the threshold is reached, then native code is used.
+    calc::CompileOptions options = options_of(calc::JitMode::tiered, true);
+    options.jit_threshold = 10;
+    const calc::CompiledExpression expression = calc::compile("x * x + 1 / x", {"x"}, options);
+    const double x = 2.0;
+    for (int evaluation = 0; evaluation < 9; ++evaluation)
+        expression.evaluate(&x, 1);
+    check(expression.native_function() == nullptr, "native code is generated too early");
+    expression.evaluate(&x, 1);
+    check((expression.native_function() != nullptr) == calc::JitCode::supported(),
+          "native code is not generated at the threshold");
+    check(expression.evaluate(&x, 1).result == 4.5,
+          "the native code gives " + describe(expression.evaluate(&x, 1)));
+
+    // Native code returns NaN on division by zero, the interpreter tells it from the real NaN.
+    const double zero = 0.0;
+    const calc::Result divided = expression.evaluate(&zero, 1);
+    check(divided.error == calc::Error::division_by_zero && divided.position == 10,
+          "the division by zero gives " + describe(divided));
+    const double nan = kNaN;
+    const calc::Result not_a_number = expression.evaluate(&nan, 1);
+    check(not_a_number.ok() && std::isnan(not_a_number.result),
+          "NaN gives " + describe(not_a_number));
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_differential();
+    check_tiers();
+    return finish();
+}
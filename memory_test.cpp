@@ -0,0 +1,189 @@
+#include "equation.h"
+#include "test_support.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <string>
+
+// Checks of the memory use: once the buffers of a context have grown to the expression, evaluating
+// it again allocates nothing. Allocations are counted by the replaced global operator new. The
+// exhausted memory resource fails the compilation with out_of_memory instead of an exception.
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+
+} // anonymous namespace
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* memory = std::malloc(size != 0 ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+using namespace calc::test;
+
+namespace {
+
+const char* const kExpressions[] = {
+    "(1 + 2) * sqrt(16) - 2 ^ 3",
+    "((((1 + 2) * 3 - 4) / 5 + 6) ^ 0.5 - sqrt(7 * 8 + 9)) * (10 - (11 - (12 - 13)))",
+    "2 + * 3",
+    "1 / (2 - 2)",
+    "((1 + 2)",
+    "x + 1",
+    "1e400 - inf",
+};
+
+// Returns the number of allocations made by 'run'.
+template <typename Function>
+size_t count_allocations(Function run)
+{
+    const size_t before = allocations;
+    run();
+    return allocations - before;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Evaluates every expression twice, the first pass grows the buffers and the second must not
+// allocate, also when a longer expression was evaluated before a shorter one.
+template <typename Calculate>
+void check_warm(const std::string& what, Calculate calculate)
+{
+    for (const char* expression : kExpressions)
+        calculate(expression);
+    for (const char* expression : kExpressions)
+    {
+        const size_t count = count_allocations([&]() { calculate(expression); });
+        check(count == 0, what + " of \"" + expression + "\" makes " + std::to_string(count)
+                          + " allocations");
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_calculate()
+{
+    // The context allocates its workspace, which shows that allocations are counted.
+    const size_t count = count_allocations([]() { calc::Context context; });
+    check(count > 0, "allocations are not counted");
+
+    calc::Context context;
+    check_warm("calculate() with the context",
+               [&](const char* expression) { return calc::calculate(expression, context); });
+    check_warm("calculate() with the thread context",
+               [](const char* expression) { return calc::calculate(expression); });
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_evaluate()
+{
+    const double values[] = {0.5, -2.0};
+    for (calc::JitMode jit : {calc::JitMode::off, calc::JitMode::eager})
+    {
+        calc::CompileOptions options;
+        options.jit = jit;
+        const calc::CompiledExpression expression =
+            calc::compile("(x + y) * sqrt(x) / (y - 1) ^ 3", {"x", "y"}, options);
+        expression.evaluate(values, 2);
+
+        const size_t count = count_allocations([&]()
+        {
+            for (int index = 0; index < 1000; ++index)
+                expression.evaluate(values, 2);
+            expression.evaluate(values, 1);
+        });
+        check(count == 0, "evaluate() makes " + std::to_string(count) + " allocations");
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_exhausted_memory()
+{
+    // The long expression does not fit the arena of a few bytes.
+    std::string expression = "1.5";
+    for (int term = 0; term < 200; ++term)
+        expression += " + 1.5 * " + std::to_string(term);
+
+    for (size_t size : {size_t{0}, size_t{64}, size_t{1024}})
+    {
+        std::byte buffer[1024];
+        std::pmr::monotonic_buffer_resource arena(buffer, size, std::pmr::null_memory_resource());
+        calc::CompileOptions options;
+        options.memory = &arena;
+        try {
+            const calc::CompiledExpression compiled =
+                calc::compile(expression.c_str(), {"x"}, options);
+            check(compiled.error() == calc::Error::out_of_memory
+                  && compiled.evaluate().error == calc::Error::out_of_memory,
+                  "the compilation in " + std::to_string(size) + " bytes gives "
+                  + describe(compiled.evaluate()));
+        }
+        catch (...) {
+            fail("the compilation in " + std::to_string(size) + " bytes throws");
+        }
+    }
+
+    // So does calculate() with the context of the arena.
+    std::byte buffer[64];
+    std::pmr::monotonic_buffer_resource small(buffer, sizeof(buffer),
+                                              std::pmr::null_memory_resource());
+    calc::Context exhausted(&small);
+    try {
+        const calc::Result result = calc::calculate(expression, exhausted);
+        check(result.error == calc::Error::out_of_memory,
+              "the calculation in 64 bytes gives " + describe(result));
+    }
+    catch (...) {
+        fail("the calculation in 64 bytes throws");
+    }
+
+    std::pmr::monotonic_buffer_resource large;
+    calc::Context context(&large);
+    check(calc::calculate(expression, context).ok(), "the context of the arena fails");
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_calculate();
+    check_evaluate();
+    check_exhausted_memory();
+    return finish();
+}
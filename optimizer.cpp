@@ -0,0 +1,407 @@
+#include "optimizer.h"
+#include "power.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+using calc::CompileScratch;
+using calc::ExpressionTree;
+using calc::Node;
+using calc::OpCode;
+using calc::Operand;
+
+// -------------------------------------------------------------------------------------------------
+
+// Builds the simplified tree node by node. Children of every node are simplified before the node,
+// so a node sees the final form of its operands. The tree and its constant pool are built in the
+// scratch buffers.
+//
+// Nodes are hash-consed if 'merge' is true: a node equal to the one already built is not added
+// again, the built one is taken instead. Children of equal nodes are equal nodes too, so equal
+// subtrees become the same node and every distinct subexpression is evaluated once.
+class Simplifier
+{
+public:
+    // 'nodes' is the number of nodes of the source tree.
+    Simplifier(const std::pmr::vector<double>& constants,
+               size_t nodes,
+               bool merge,
+               CompileScratch& scratch)
+        : constants_(constants)
+        , tree_(scratch.simplified)
+        , pool_(scratch.pool)
+        , table_(scratch.table)
+        , merge_(merge)
+    {
+        tree_.clear();
+        pool_.clear();
+        table_.clear();
+        if (!merge_)
+            return;
+
+        // Every source node adds at most two nodes, the table is kept at most half full.
+        size_t size = 16;
+        while (size < 4 * nodes)
+            size *= 2;
+        table_.assign(size, kEmpty);
+    }
+
+    // Adds the node of the source tree, its children are already mapped to the indices of the
+    // simplified tree. Returns the index of the node in the simplified tree.
+    uint32_t add(const Node& node);
+
+private:
+    // Adds the node unless the equal node is already built, returns the index of the node.
+    uint32_t push(const Node& node);
+    uint32_t push_constant(double value);
+
+    size_t hash(const Node& node) const;
+    bool equal(const Node& left, const Node& right) const;
+    uint32_t push_operation(OpCode code, uint32_t left, uint32_t right, uint32_t position);
+
+    // Lowers the power with the constant exponent into cheaper operations. Returns false if the
+    // exponent has no cheaper form.
+    bool reduce_power(const Node& node, uint32_t& index);
+
+    bool is_constant(uint32_t index) const;
+    bool is_constant(uint32_t index, double value) const;
+    double constant(uint32_t index) const;
+
+    // Returns true and the value of the operation if all operands of the node are constants and
+    // the operation can be done at compile time.
+    bool fold(const Node& node, double& value) const;
+
+    // The empty slot of the hash table.
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    const std::pmr::vector<double>& constants_;
+    ExpressionTree& tree_;
+    std::pmr::vector<double>& pool_;
+    std::pmr::vector<uint32_t>& table_; // indices of the built nodes, open addressing
+    bool merge_;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// Returns the bits of the value, constants are equal if their bits are equal, so 0 and -0 or NaNs
+// with different payloads stay different.
+uint64_t bits_of(double value)
+{
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint32_t Simplifier::add(const Node& node)
+{
+    if (node.leaf)
+    {
+        if (node.operand.kind == Operand::constant)
+            return push_constant(constants_[node.operand.index]);
+        return push(node);
+    }
+
+    double value = 0.0;
+    if (fold(node, value))
+        return push_constant(value);
+
+    const Node& left = tree_[node.left];
+    switch (node.code)
+    {
+    case OpCode::un_min:
+        if (!left.leaf && left.code == OpCode::un_min)
+            return left.left;
+        break;
+    case OpCode::add:
+        if (is_constant(node.right, -0.0))
+            return node.left;
+        if (is_constant(node.left, -0.0))
+            return node.right;
+        break;
+    case OpCode::sub:
+        if (is_constant(node.right, 0.0))
+            return node.left;
+        break;
+    case OpCode::mul:
+        if (is_constant(node.right, 1.0))
+            return node.left;
+        if (is_constant(node.left, 1.0))
+            return node.right;
+        break;
+    case OpCode::div:
+        if (is_constant(node.right, 1.0))
+            return node.left;
+        break;
+    case OpCode::pow:
+    {
+        uint32_t index = 0;
+        if (reduce_power(node, index))
+            return index;
+        break;
+    }
+    case OpCode::sqrt:
+    case OpCode::recip:
+        break;
+    }
+
+    return push(node);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool Simplifier::reduce_power(const Node& node, uint32_t& index)
+{
+    if (!is_constant(node.right))
+        return false;
+
+    const uint32_t x = node.left;
+    const uint32_t position = node.position;
+    const double exponent = constant(node.right);
+    if (exponent == 1.0)
+    {
+        index = x;
+    }
+    else if (exponent == 2.0)
+    {
+        index = push_operation(OpCode::mul, x, x, position);
+    }
+    else if (exponent == -1.0)
+    {
+        index = push_operation(OpCode::recip, x, x, position);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint32_t Simplifier::push(const Node& node)
+{
+    if (!merge_)
+    {
+        tree_.push_back(node);
+        return static_cast<uint32_t>(tree_.size() - 1);
+    }
+
+    const size_t mask = table_.size() - 1;
+    for (size_t slot = hash(node) & mask;; slot = (slot + 1) & mask)
+    {
+        const uint32_t index = table_[slot];
+        if (index == kEmpty)
+        {
+            table_[slot] = static_cast<uint32_t>(tree_.size());
+            tree_.push_back(node);
+            return table_[slot];
+        }
+        if (equal(tree_[index], node))
+            return index;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+size_t Simplifier::hash(const Node& node) const
+{
+    uint64_t key = 0;
+    if (!node.leaf)
+        key = (uint64_t{node.left} << 32 | node.right) ^ static_cast<uint64_t>(node.code) << 29;
+    else if (node.operand.kind == Operand::constant)
+        key = bits_of(pool_[node.operand.index]);
+    else
+        key = node.operand.index;
+
+    // The finalizer of SplitMix64 spreads close indices over the table.
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ull;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBull;
+    key ^= key >> 31;
+    return static_cast<size_t>(key);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// The position is not compared, equal operations at different places of the expression are merged
+// and keep the position of the first one.
+bool Simplifier::equal(const Node& left, const Node& right) const
+{
+    if (left.leaf != right.leaf)
+        return false;
+    if (!left.leaf)
+        return left.code == right.code && left.left == right.left && left.right == right.right;
+    if (left.operand.kind != right.operand.kind)
+        return false;
+    if (left.operand.kind == Operand::constant)
+        return bits_of(pool_[left.operand.index]) == bits_of(pool_[right.operand.index]);
+    return left.operand.index == right.operand.index;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint32_t Simplifier::push_constant(double value)
+{
+    Node node;
+    node.leaf = true;
+    node.operand = calc::make_operand(Operand::constant, static_cast<uint32_t>(pool_.size()));
+    pool_.push_back(value);
+
+    // The equal constant is already in the pool if the node is merged.
+    const uint32_t index = push(node);
+    if (tree_[index].operand.index != node.operand.index)
+        pool_.pop_back();
+    return index;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+uint32_t Simplifier::push_operation(OpCode code, uint32_t left, uint32_t right, uint32_t position)
+{
+    Node node;
+    node.code = code;
+    node.left = left;
+    node.right = right;
+    node.position = position;
+    return push(node);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool Simplifier::is_constant(uint32_t index) const
+{
+    return tree_[index].leaf && tree_[index].operand.kind == Operand::constant;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Compares bits of the values, so 0 and -0 are different constants here.
+bool Simplifier::is_constant(uint32_t index, double value) const
+{
+    return is_constant(index)
+        && constant(index) == value
+        && std::signbit(constant(index)) == std::signbit(value);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+double Simplifier::constant(uint32_t index) const
+{
+    return pool_[tree_[index].operand.index];
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool Simplifier::fold(const Node& node, double& value) const
+{
+    if (!is_constant(node.left))
+        return false;
+    if (!calc::is_unary(node.code) && !is_constant(node.right))
+        return false;
+
+    const double a = constant(node.left);
+    const double b = calc::is_unary(node.code) ? 0.0 : constant(node.right);
+    switch (node.code)
+    {
+    case OpCode::un_min: value = -a;                break;
+    case OpCode::add:    value = a + b;             break;
+    case OpCode::sub:    value = a - b;             break;
+    case OpCode::mul:    value = a * b;             break;
+    case OpCode::pow:    value = calc::power(a, b); break;
+    case OpCode::sqrt:   value = std::sqrt(a);      break;
+    case OpCode::recip:  value = 1.0 / a;           break;
+    case OpCode::div:
+        // Division by zero is left to the evaluation which reports the error.
+        if (b == 0.0)
+            return false;
+        value = a / b;
+        break;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Copies nodes of the simplified tree which are reachable from the root to 'tree', so the root
+// becomes the last node again, and constants used by these nodes to 'constants'.
+void drop_unused(CompileScratch& scratch,
+                 uint32_t root,
+                 ExpressionTree& tree,
+                 std::pmr::vector<double>& constants)
+{
+    const ExpressionTree& simplified = scratch.simplified;
+    std::pmr::vector<uint8_t>& used = scratch.used;
+    used.assign(root + 1, 0);
+    used[root] = 1;
+    for (uint32_t index = root + 1; index-- > 0;)
+    {
+        const Node& node = simplified[index];
+        if (!used[index] || node.leaf)
+            continue;
+        used[node.left] = 1;
+        if (!calc::is_unary(node.code))
+            used[node.right] = 1;
+    }
+
+    tree.clear();
+    constants.clear();
+    std::pmr::vector<uint32_t>& mapped = scratch.mapped;
+    mapped.assign(root + 1, 0);
+    for (uint32_t index = 0; index <= root; ++index)
+    {
+        if (!used[index])
+            continue;
+
+        Node node = simplified[index];
+        if (node.leaf && node.operand.kind == Operand::constant)
+        {
+            node.operand.index = static_cast<uint32_t>(constants.size());
+            constants.push_back(scratch.pool[simplified[index].operand.index]);
+        }
+        else if (!node.leaf)
+        {
+            node.left = mapped[node.left];
+            node.right = mapped[node.right];
+        }
+        mapped[index] = static_cast<uint32_t>(tree.size());
+        tree.push_back(node);
+    }
+}
+
+} // anonymous namespace
+
+namespace calc {
+
+// -------------------------------------------------------------------------------------------------
+
+void optimize(ExpressionTree &tree,
+              std::pmr::vector<double> &constants,
+              CompileScratch &scratch,
+              bool merge)
+{
+    if (tree.empty())
+        return;
+
+    Simplifier simplifier(constants, tree.size(), merge, scratch);
+    std::pmr::vector<uint32_t>& mapped = scratch.mapped;
+    mapped.assign(tree.size(), 0);
+    for (size_t index = 0; index < tree.size(); ++index)
+    {
+        Node node = tree[index];
+        if (!node.leaf)
+        {
+            node.left = mapped[node.left];
+            node.right = is_unary(node.code) ? node.left : mapped[node.right];
+        }
+        mapped[index] = simplifier.add(node);
+    }
+
+    drop_unused(scratch, mapped.back(), tree, constants);
+}
+
+} // namespace calc
@@ -0,0 +1,39 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "expression_tree.h"
+
+#include <vector>
+
+namespace calc {
+
+// Simplifies the expression tree, 'constants' is the constant pool the tree leaves refer to. Both
+// the tree and the pool are rebuilt, nodes and constants which are not used any more are dropped.
+// 'scratch' keeps the temporary buffers.
+//
+// Subtrees without variables are folded into constants unless they divide by zero, so the error
+// is still reported by the evaluation. Identities are applied only if they give the same result
+// for every input including NaN, infinities and signed zeros:
+//   x * 1, 1 * x, x / 1, x ^ 1, x - 0, x + (-0), (-0) + x -> x
+//   -(-x) -> x
+// x + 0 is kept, it turns -0 into +0. x ^ 0 is kept too, 1 would drop the division by zero in x.
+//
+// Powers are strength reduced only if the single operation is correctly rounded, so the result is
+// the same as std::pow() gives:
+//   x ^ 2 -> x * x
+//   x ^ -1 -> 1 / x, zero gives infinity like std::pow() does instead of the division error
+// Other exponents are kept: x * x * x, squaring and sqrt(x) differ from std::pow() in the last bits
+// for some x.
+//
+// If 'merge' is true, equal subtrees are merged into one node, so the tree becomes a DAG and every
+// distinct subexpression, e.g. a * a in sqrt(a * a + b) / (a * a), is evaluated once. Constants
+// with equal bits are merged too. The merged node keeps its register until its last parent is
+// evaluated, so the DAG may need more registers than the tree.
+void optimize(ExpressionTree &tree,
+              std::pmr::vector<double> &constants,
+              CompileScratch &scratch,
+              bool merge);
+
+} // namespace calc
+
+#endif // OPTIMIZER_H
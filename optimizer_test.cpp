@@ -0,0 +1,348 @@
+#include "equation.h"
+#include "power.h"
+#include "test_support.h"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+// Checks of the constant folding, the simplification, the strength reduction and the merging of
+// equal subtrees. Known results of the original calculator are checked with and without the
+// optimizer, powers are compared with std::pow(), then random expressions are evaluated by the
+// plain program, which is the reference, and compared bit for bit with the optimized one.
+
+using namespace calc::test;
+
+namespace {
+
+const std::vector<std::string> kVariables = {"a", "b", "c"};
+
+calc::CompileOptions plain_options()
+{
+    calc::CompileOptions options;
+    options.optimize = false;
+    return options;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Known results
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Case
+{
+    const char* expression;
+    calc::Error error;
+    double result;
+};
+
+// Results of the original calculator. It reported parse failures as "Incorrect expression", their
+// codes are more detailed now, but they stay parse failures.
+const Case kCases[] = {
+    {"1 + 2", calc::Error::none, 3.0},
+    {"2 ^ 10", calc::Error::none, 1024.0},
+    {"-(3) * 2", calc::Error::none, -6.0},
+    {"-3 ^ 2", calc::Error::none, 9.0},
+    {"2 ^ 3 ^ 2", calc::Error::none, 64.0},
+    {"-(-(2))", calc::Error::none, 2.0},
+    {"sqrt(16) / 4", calc::Error::none, 1.0},
+    {"0.1 + 0.2", calc::Error::none, 0.30000000000000004},
+    {"0x10 + 1", calc::Error::none, 17.0},
+    {"1e400", calc::Error::none, kInf},
+    {"inf - inf", calc::Error::none, kNaN},
+    {"sqrt(-1)", calc::Error::none, kNaN},
+    {"5 ^ 0", calc::Error::none, 1.0},
+    {"2 ^ (-1)", calc::Error::none, 0.5},
+    {"0 ^ (-1)", calc::Error::none, kInf},
+    {"(-inf) ^ 0.5", calc::Error::none, kInf},
+    {"(-0) ^ 0.5", calc::Error::none, 0.0},
+    {"1 / 0", calc::Error::division_by_zero, 0.0},
+    {"1/0 + 1", calc::Error::division_by_zero, 0.0},
+    {"0 * (1/0)", calc::Error::division_by_zero, 0.0},
+    {"(1 / 0) ^ 0", calc::Error::division_by_zero, 0.0},
+    {"(1 / (1 - 1)) ^ 0", calc::Error::division_by_zero, 0.0},
+    {"(2 / 0) ^ ((inf * 2) ^ (-1))", calc::Error::division_by_zero, 0.0},
+    {"2 + * 3", calc::Error::incorrect_order, 0.0},
+    {"2 3", calc::Error::incorrect_order, 0.0},
+    {"* 2", calc::Error::incorrect_order, 0.0},
+    {"--2", calc::Error::incorrect_order, 0.0},
+    {"1 - -2", calc::Error::incorrect_order, 0.0},
+    {"(2)(3)", calc::Error::incorrect_order, 0.0},
+    {"1 +", calc::Error::incorrect_expression, 0.0},
+    {"(1 + 2", calc::Error::extra_open_parenthesis, 0.0},
+    {"1 + 2)", calc::Error::extra_close_parenthesis, 0.0},
+    {"", calc::Error::no_operands, 0.0},
+    {"   ", calc::Error::no_operands, 0.0},
+    {"sqrt", calc::Error::no_operands, 0.0},
+    {"x + 1", calc::Error::missing_value, 0.0}
+};
+
+// -------------------------------------------------------------------------------------------------
+
+void check_case(const Case& known, const calc::Result& result, const char* mode)
+{
+    const bool matches = known.error == calc::Error::none
+        ? result.ok() && same_value(result.result, known.result)
+        : result.error == known.error;
+    check(matches, std::string(mode) + ": \"" + known.expression + "\" gives " + describe(result));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_known_results()
+{
+    calc::Context context;
+    for (const Case& known : kCases)
+    {
+        check_case(known, calc::calculate(known.expression), "calculate()");
+        check_case(known, calc::calculate(known.expression, context), "calculate() in context");
+        check_case(known, calc::compile(known.expression, plain_options()).evaluate(), "plain");
+        check_case(known, calc::compile(known.expression).evaluate(), "optimized");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Folding
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Checks the number of instructions left by the optimizer and the result for x = 'x'.
+void check_simplified(const char* expression, size_t instructions, double x, double expected)
+{
+    const calc::CompiledExpression compiled = calc::compile(expression, {"x"});
+    check(compiled.program().size() == instructions,
+          std::string("\"") + expression + "\" keeps " + std::to_string(compiled.program().size())
+          + " instructions instead of " + std::to_string(instructions));
+
+    const calc::Result result = compiled.evaluate(&x, 1);
+    check(result.ok() && same_value(result.result, expected),
+          std::string("\"") + expression + "\" gives " + describe(result));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_folding()
+{
+    // Subtrees without variables become constants.
+    check_simplified("2 * 3 + 4", 0, 0.0, 10.0);
+    check_simplified("x * (2 * 3 + 4)", 1, 2.0, 20.0);
+    check_simplified("sqrt(16) * x", 1, 0.5, 2.0);
+
+    // Identities which keep the result for every input.
+    check_simplified("x * 1", 0, -0.0, -0.0);
+    check_simplified("1 * x", 0, kNaN, kNaN);
+    check_simplified("x / 1", 0, kInf, kInf);
+    check_simplified("x ^ 1", 0, -2.0, -2.0);
+    check_simplified("x - 0", 0, -0.0, -0.0);
+    check_simplified("-(-(x))", 0, -0.0, -0.0);
+
+    // x + 0 turns -0 into +0, x ^ 0 would drop the division by zero in x.
+    check_simplified("x + 0", 1, -0.0, 0.0);
+    check_simplified("x ^ 0", 1, kNaN, 1.0);
+
+    // Divisions by zero are not folded, so the evaluation still reports them.
+    const calc::CompiledExpression divided = calc::compile("x + 1 / 0", {"x"});
+    const double x = 1.0;
+    check(divided.ok() && divided.evaluate(&x, 1).error == calc::Error::division_by_zero,
+          "\"x + 1 / 0\" does not report the division by zero");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Powers
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Returns true if the program of the expression has an instruction with the code.
+bool has_instruction(const calc::CompiledExpression& expression, calc::OpCode code)
+{
+    for (const calc::Instruction& instruction : expression.program())
+    {
+        if (instruction.code == code)
+            return true;
+    }
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Powers give exactly what std::pow() gives, as they did in the original calculator, in every mode.
+void check_powers()
+{
+    std::vector<double> bases(std::begin(kValues), std::end(kValues));
+    std::mt19937_64 random(10);
+    std::uniform_real_distribution<double> distribution(-4.0, 4.0);
+    for (int index = 0; index < 2000; ++index)
+        bases.push_back(distribution(random));
+    for (double base : {0.1, 1.1, 1e-160, 1e160, 4.9e-324})
+        bases.push_back(base);
+
+    std::vector<double> exponents = {0.5, -0.5, 1.5, 1.0 / 3.0};
+    for (int exponent = -8; exponent <= 8; ++exponent)
+        exponents.push_back(exponent);
+
+    for (double exponent : exponents)
+    {
+        char text[64];
+        std::snprintf(text, sizeof(text), "x ^ (%.17g)", exponent);
+        const calc::CompiledExpression plain = calc::compile(text, {"x"}, plain_options());
+        const calc::CompiledExpression optimized = calc::compile(text, {"x"});
+        calc::CompileOptions eager;
+        eager.jit = calc::JitMode::eager;
+        const calc::CompiledExpression native = calc::compile(text, {"x"}, eager);
+        for (double base : bases)
+        {
+            const double expected = std::pow(base, exponent);
+            const calc::Result results[] = {plain.evaluate(&base, 1), optimized.evaluate(&base, 1),
+                                            native.evaluate(&base, 1)};
+            for (const calc::Result& result : results)
+            {
+                check(result.ok() && same_value(result.result, expected)
+                      && same_value(calc::power(base, exponent), expected),
+                      std::string(text) + " for x = " + describe({base}) + " gives "
+                      + describe(result) + " instead of " + describe({expected}));
+            }
+        }
+    }
+
+    // Constants are folded with the same function.
+    check(calc::calculate("0.1 ^ 7").result == std::pow(0.1, 7.0), "0.1 ^ 7 is not std::pow()");
+    check(calc::calculate("1.1 ^ 8").result == std::pow(1.1, 8.0), "1.1 ^ 8 is not std::pow()");
+
+    // Only single correctly rounded operations replace the power.
+    check(!has_instruction(calc::compile("x ^ 2", {"x"}), calc::OpCode::pow),
+          "x ^ 2 is not strength reduced");
+    check(has_instruction(calc::compile("x ^ (-1)", {"x"}), calc::OpCode::recip),
+          "x ^ (-1) is not strength reduced");
+    check(has_instruction(calc::compile("x ^ 3", {"x"}), calc::OpCode::pow),
+          "x ^ 3 is strength reduced");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Merging
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Compares results of the plain and the optimized programs of the expression for a few rows.
+void check_same_results(const std::string& expression,
+                        const calc::CompiledExpression& plain,
+                        const calc::CompiledExpression& optimized)
+{
+    ExpressionGenerator generate(20);
+    for (int row = 0; row < 64; ++row)
+    {
+        const double values[] = {generate.value(), generate.value(), generate.value()};
+        const calc::Result reference = plain.evaluate(values, 3);
+        const calc::Result result = optimized.evaluate(values, 3);
+        if (!same_result(result, reference, expression))
+        {
+            fail("\"" + expression + "\" gives " + describe(result) + " instead of "
+                 + describe(reference));
+            return;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_merging()
+{
+    // Equal subtrees are evaluated once.
+    struct Merged
+    {
+        const char* expression;
+        size_t instructions;
+    };
+    const Merged kMerged[] = {
+        {"(a * b) + (a * b)", 2},
+        {"sqrt(a * a + b * b) * sqrt(a * a + b * b)", 5},
+        {"(a + 1) * (a + 1) - (a + 1)", 3},
+        {"(a - b) / (c - b) + (a - b) / (c - b)", 4},
+    };
+    for (const Merged& merged : kMerged)
+    {
+        const calc::CompiledExpression plain =
+            calc::compile(merged.expression, kVariables, plain_options());
+        const calc::CompiledExpression optimized = calc::compile(merged.expression, kVariables);
+        check(optimized.program().size() == merged.instructions
+              && optimized.program().size() < plain.program().size(),
+              std::string("\"") + merged.expression + "\" takes "
+              + std::to_string(optimized.program().size()) + " instructions");
+        check_same_results(merged.expression, plain, optimized);
+    }
+
+    // A merged node keeps its register until its last parent, so the DAG of this expression
+    // needs more registers than the evaluation has, 64. The tree without merging is compiled.
+    std::string sum = "(a + 1)";
+    std::string product = "(a + 1)";
+    for (int term = 2; term <= 70; ++term)
+    {
+        sum += " + (a + " + std::to_string(term) + ")";
+        product += " * (a + " + std::to_string(term) + ")";
+    }
+    const std::string expression = sum + " + " + product;
+    const calc::CompiledExpression plain =
+        calc::compile(expression.c_str(), kVariables, plain_options());
+    const calc::CompiledExpression optimized = calc::compile(expression.c_str(), kVariables);
+    check(plain.ok() && optimized.ok() && optimized.registers() <= 64,
+          "the expression of 140 terms is not compiled: " + describe(optimized.evaluate()));
+    check_same_results(expression, plain, optimized);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//      Differential check
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void check_differential()
+{
+    constexpr int kExpressions = 3000;
+    constexpr size_t kRows = 64;
+
+    ExpressionGenerator generate(20240601);
+    for (int index = 0; index < kExpressions; ++index)
+    {
+        const std::string expression = generate(6);
+        const calc::CompiledExpression plain =
+            calc::compile(expression.c_str(), kVariables, plain_options());
+        const calc::CompiledExpression optimized = calc::compile(expression.c_str(), kVariables);
+        if (!plain.ok() || !optimized.ok())
+        {
+            fail("\"" + expression + "\" is not compiled: "
+                 + calc::error_message(plain.ok() ? optimized.error() : plain.error()));
+            continue;
+        }
+
+        for (size_t row = 0; row < kRows; ++row)
+        {
+            const double values[] = {generate.value(), generate.value(), generate.value()};
+            const calc::Result reference = plain.evaluate(values, 3);
+            const calc::Result result = optimized.evaluate(values, 3);
+            if (!same_result(result, reference, expression))
+            {
+                fail("\"" + expression + "\" row " + std::to_string(row) + " gives "
+                     + describe(result) + " instead of " + describe(reference));
+                break;
+            }
+        }
+    }
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_known_results();
+    check_folding();
+    check_powers();
+    check_merging();
+    check_differential();
+    return finish();
+}
@@ -0,0 +1,55 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <cstddef>
+#include <string_view>
+
+namespace calc {
+
+class Context;
+
+// Characters are classified without the C locale, so the expression means the same in any locale.
+// The tokenizer and the keys of ExpressionCache share this classification.
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Returns true if the character is a token on its own - an operation or a parenthesis. Other
+// tokens are words: numbers, variables and functions last up to a space or a symbol.
+inline bool is_symbol(char c)
+{
+    switch (c)
+    {
+    case '-':
+    case '+':
+    case '*':
+    case '/':
+    case '^':
+    case '(':
+    case ')':
+        return true;
+    }
+    return false;
+}
+
+// Stages of the parsing which compile() and calculate() run together. They are not a part of the
+// public API, benchmarks use them to measure every stage alone. Context grants access to its
+// buffers to this struct only, so the public header declares nothing else for the benchmarks.
+struct ParserStages
+{
+    // Splits the expression into tokens and returns the number of tokens.
+    static size_t count_tokens(std::string_view expression);
+
+    // Builds reverse Polish notation of the expression in the buffers of 'context'. Returns the
+    // number of items of the notation or 0 if the expression is not correct.
+    static size_t build_reverse_polish_notation(std::string_view expression, Context &context);
+
+    // The same as above, but the parser is constructed for this expression alone, so it is the
+    // cost of the parser setup and of the parsing into new buffers.
+    static size_t build_reverse_polish_notation(std::string_view expression);
+};
+
+} // namespace calc
+
+#endif // PARSER_H
@@ -0,0 +1,223 @@
+#include "equation.h"
+#include "expression_cache.h"
+#include "test_support.h"
+
+#include <clocale>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+
+// Checks of the tokenizer: tokens are split by spaces and symbols, words are functions, special
+// numbers or variables, and malformed numbers are not read past their end. Numbers are read once,
+// correctly rounded and in any locale, as strtod() reads them in the C locale. Expressions given
+// by std::string_view are read up to the end of the view, not up to the NUL terminator.
+
+using namespace calc::test;
+
+namespace {
+
+// Checks the result of the expression, the expected error is none if the value is expected.
+// calculate() has no values of variables, it fails with missing_value at the position 0.
+void check_expression(const char* expression, double expected,
+                      calc::Error error = calc::Error::none, uint32_t position = 0)
+{
+    const calc::Result result = calc::calculate(expression);
+    const bool correct = error == calc::Error::none
+        ? result.ok() && same_value(result.result, expected)
+        : result.error == error && result.position == position;
+    check(correct, std::string("\"") + expression + "\" gives " + describe(result));
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_spaces()
+{
+    check_expression("1+2*3", 7.0);
+    check_expression(" \t1\n+\r2 \v*\f3\r\n", 7.0);
+    check_expression("sqrt(4)+-(1)", 0.0, calc::Error::incorrect_order, 8);
+    check_expression("2*(3-1)^2", 8.0);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_special_numbers()
+{
+    check_expression("inf", kInf);
+    check_expression("INF + 1", kInf);
+    check_expression("-Infinity", -kInf);
+    check_expression("nan", kNaN);
+    check_expression("NaN * 0", kNaN);
+    check_expression("inf-inf", kNaN);
+
+    // The word lasts up to a space or a symbol, longer words are variables.
+    check_expression("infx", 0.0, calc::Error::missing_value, 0);
+    check_expression("1 + infinity1", 0.0, calc::Error::missing_value, 0);
+    check_expression("nan2", 0.0, calc::Error::missing_value, 0);
+    check_expression("sqrt2", 0.0, calc::Error::missing_value, 0);
+    check_expression("sqrt (16)", 4.0);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_points()
+{
+    check_expression(".5", 0.5);
+    check_expression("5.", 5.0);
+    check_expression("5.e1", 50.0);
+
+    // The point which is not a part of a number is a word, so it is taken for a variable.
+    check_expression(".", 0.0, calc::Error::missing_value, 0);
+    check_expression("1 + .", 0.0, calc::Error::missing_value, 0);
+    const calc::CompiledExpression point = calc::compile("1 + .");
+    check(point.variables().size() == 1 && point.variables()[0] == ".",
+          "the point is not a variable of \"1 + .\"");
+
+    // The number ends at the second point, which starts the next number.
+    check_expression("1.2.3", 0.0, calc::Error::incorrect_order, 3);
+    check_expression("1..2", 0.0, calc::Error::incorrect_order, 2);
+    check_expression("1 . 2", 0.0, calc::Error::incorrect_order, 2);
+    check_expression("1,5", 0.0, calc::Error::incorrect_order, 1);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_numbers()
+{
+    // Hexadecimal numbers, as strtod() reads them.
+    check_expression("0x1p-2", 0.25);
+    check_expression("0x1.8p1", 3.0);
+    check_expression("0X10", 16.0);
+    check_expression("0x.8", 0.5);
+
+    // Numbers out of the double range become infinity or zero.
+    check_expression("1e400", kInf);
+    check_expression("0x1p2000", kInf);
+    check_expression("123456789e305", kInf);
+    check_expression("1e-400", 0.0);
+    check_expression("0x1p-2000", 0.0);
+    check_expression("0.000001e-320", 0.0);
+    check_expression("4.9e-324", 4.9e-324);
+    check_expression("2.2250738585072011e-308", 2.2250738585072011e-308);
+
+    // Halfway and hard cases are rounded correctly.
+    check_expression("9007199254740993", 9007199254740992.0);
+    check_expression("1e23", 1e23);
+    check_expression("0.1", 0.1);
+    check_expression("1.7976931348623157e308", 1.7976931348623157e308);
+
+    // The exponent without digits is not a part of the number.
+    check_expression("1e", 0.0, calc::Error::incorrect_order, 1);
+    check_expression("1e+", 0.0, calc::Error::incorrect_order, 1);
+    check_expression("0x", 0.0, calc::Error::incorrect_order, 1);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Random doubles printed with 17 digits are read back exactly, also where the locale uses the
+// comma as the decimal point.
+void check_round_trip()
+{
+    std::mt19937_64 random(13);
+    for (const char* locale : {"C", "de_DE.UTF-8", "fr_FR.UTF-8"})
+    {
+        if (std::setlocale(LC_ALL, locale) == nullptr)
+            continue;
+
+        for (int index = 0; index < 20000; ++index)
+        {
+            const uint64_t bits = random() & ~(uint64_t{1} << 63);
+            double value = 0.0;
+            std::memcpy(&value, &bits, sizeof(value));
+            if (!std::isfinite(value))
+                continue;
+
+            std::setlocale(LC_NUMERIC, "C");
+            char text[64];
+            std::snprintf(text, sizeof(text), "%.17g", value);
+            std::setlocale(LC_ALL, locale);
+            const calc::Result result = calc::calculate(text);
+            if (!result.ok() || !same_value(result.result, value))
+            {
+                fail(std::string("\"") + text + "\" in the locale " + locale + " gives "
+                     + describe(result));
+                break;
+            }
+        }
+    }
+    std::setlocale(LC_ALL, "C");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Checks the result of the expression which is a part of a larger buffer.
+void check_view(std::string_view view, double expected,
+                calc::Error error = calc::Error::none, uint32_t position = 0)
+{
+    calc::Context context;
+    calc::ExpressionCache cache;
+    const calc::Result results[] = {calc::calculate(view), calc::calculate(view, context),
+                                    calc::compile(view).evaluate(), cache.calculate(view)};
+    for (const calc::Result& result : results)
+    {
+        const bool correct = error == calc::Error::none
+            ? result.ok() && same_value(result.result, expected)
+            : result.error == error && result.position == position;
+        check(correct, "\"" + std::string(view) + "\" gives " + describe(result));
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void check_views()
+{
+    // Every view is followed by characters which would change the result if they were read. The
+    // buffer has no NUL terminator.
+    const char buffer[] = {'1', ' ', '+', ' ', '2', '.', '5', 'i', 'n', 'f', 's', 'q', 'r', 't',
+                           '(', '4', ')', '*', '0', 'x', '1', 'p', '3', '1', 'e', '5', '0'};
+    const std::string_view text(buffer, sizeof(buffer));
+
+    check_view(text.substr(0, 5), 3.0);                  // "1 + 2" of "1 + 2.5"
+    check_view(text.substr(0, 7), 3.5);                  // "1 + 2.5" of "1 + 2.5inf"
+    check_view(text.substr(4, 2), 2.0);                  // "2." of "2.5"
+    check_view(text.substr(7, 3), kInf);                 // "inf" of "infsqrt"
+    check_view(text.substr(18, 5), 8.0);                 // "0x1p3" of "0x1p31e50"
+    check_view(text.substr(18, 4), 0.0, calc::Error::incorrect_order, 3); // "0x1p" of "0x1p3"
+    check_view(text.substr(23, 3), 1e5);                 // "1e5" of "1e50"
+    check_view(text.substr(23, 2), 0.0, calc::Error::incorrect_order, 1); // "1e" of "1e5"
+    check_view(text.substr(7, 2), 0.0, calc::Error::missing_value, 0);    // "in" of "inf"
+    check_view(text.substr(10, 3), 0.0, calc::Error::missing_value, 0);   // "sqr" of "sqrt"
+    check_view(text.substr(10, 4), 0.0, calc::Error::no_operands, 0);     // "sqrt" of "sqrt("
+    check_view(text.substr(10, 7), 2.0);                 // "sqrt(4)" of "sqrt(4)*"
+    check_view(text.substr(14, 3), 4.0);                 // "(4)" of "(4)*0x1p3"
+    check_view(text.substr(14, 2), 0.0, calc::Error::extra_open_parenthesis, 0); // "(4"
+    check_view(text.substr(0, 0), 0.0, calc::Error::no_operands, 0);
+
+    // Positions refer to the view, not to the buffer.
+    check_view(text.substr(2, 3), 0.0, calc::Error::incorrect_order, 0); // "+ 2"
+
+    // Variables of the view are bound by compile().
+    const std::string_view variables = "x + y1 * 2";
+    const calc::CompiledExpression compiled = calc::compile(variables.substr(0, 5), {"x", "y"});
+    const double values[] = {1.0, 2.0};
+    check(compiled.ok() && compiled.evaluate(values, 2).result == 3.0,
+          "\"x + y\" of \"x + y1\" gives " + describe(compiled.evaluate(values, 2)));
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    check_spaces();
+    check_special_numbers();
+    check_points();
+    check_numbers();
+    check_round_trip();
+    check_views();
+    return finish();
+}
@@ -0,0 +1,24 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <cmath>
+
+namespace calc {
+
+// Raises 'base' to 'exponent' like std::pow() and gives exactly the same result. The exponent 2
+// takes one multiplication and the exponent -1 one division instead of the call, both operations
+// are correctly rounded and handle zeros, infinities and NaN like std::pow() does. Other exponents
+// are left to std::pow(): squaring for bigger ones and std::sqrt() for 0.5 differ from it in the
+// last bits for some bases.
+inline double power(double base, double exponent)
+{
+    if (exponent == 2.0)
+        return base * base;
+    if (exponent == -1.0)
+        return 1.0 / base;
+    return std::pow(base, exponent);
+}
+
+} // namespace calc
+
+#endif // POWER_H
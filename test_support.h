@@ -0,0 +1,138 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include "equation.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+
+// Helpers of the checks run by ctest. Every check is a program which prints its failures and
+// returns 1 from main() if there are any, see finish().
+
+namespace calc::test {
+
+constexpr double kInf = std::numeric_limits<double>::infinity();
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+inline int failures = 0;
+
+// Reports the failure, only the first ones are printed.
+inline void fail(const std::string& what)
+{
+    if (failures++ < 20)
+        std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+}
+
+inline void check(bool condition, const std::string& what)
+{
+    if (!condition)
+        fail(what);
+}
+
+// Prints the summary and returns the exit code of the check.
+inline int finish()
+{
+    if (failures != 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Values are the same if their bits are the same, any NaNs are the same too.
+inline bool same_value(double left, double right)
+{
+    if (std::isnan(left) || std::isnan(right))
+        return std::isnan(left) && std::isnan(right);
+    return std::memcmp(&left, &right, sizeof(double)) == 0;
+}
+
+// Results of the evaluation are the same if they have the same value or the same error. The order
+// of the operations depends on the registers and on the optimization, so the failure can be
+// reported for another division by zero, but it must point to a division.
+inline bool same_result(const Result& left, const Result& right, const std::string& expression)
+{
+    if (left.error != right.error)
+        return false;
+    if (left.ok())
+        return same_value(left.result, right.result);
+    return left.error != Error::division_by_zero
+        ? left.position == right.position
+        : left.position < expression.size() && expression[left.position] == '/';
+}
+
+inline std::string describe(const Result& result)
+{
+    if (!result.ok())
+        return error_message(result.error);
+
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.17g", result.result);
+    return text;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Values of the variables include zeros of both signs, infinities, NaN and a subnormal number.
+constexpr double kValues[] = {0.0, -0.0, 1.0, -1.0, 2.0, -3.0, 0.25, 1.5, -2.5, 1e300, 1e-310,
+                              kInf, -kInf, kNaN};
+
+// Builds random expressions of the variables a, b and c. Operands of an operation are often the
+// same subexpression, so the optimizer merges them, and powers often have constant exponents.
+// Unary minus is put in parentheses, the grammar takes it only at the beginning or after '('.
+class ExpressionGenerator
+{
+public:
+    explicit ExpressionGenerator(uint32_t seed)
+        : random_(seed)
+    {
+    }
+
+    std::string operator()(int depth)
+    {
+        static const char* const leaves[] = {"a", "b", "c", "0", "2", "1.5", "0.5", "inf"};
+        static const char* const operations[] = {" + ", " - ", " * ", " / ", " ^ "};
+        static const char* const exponents[] = {"2", "3", "4", "(-1)", "0", "0.5", "7"};
+
+        if (depth == 0 || random_() % 4 == 0)
+            return leaves[random_() % 8];
+
+        switch (random_() % 8)
+        {
+        case 0:
+            return "sqrt(" + (*this)(depth - 1) + ")";
+        case 1:
+            return "(-(" + (*this)(depth - 1) + "))";
+        case 2:
+            return "(" + (*this)(depth - 1) + ") ^ " + exponents[random_() % 7];
+        default:
+        {
+            const std::string left = (*this)(depth - 1);
+            const std::string right = random_() % 3 == 0 ? left : (*this)(depth - 1);
+            return "(" + left + operations[random_() % 5] + right + ")";
+        }
+        }
+    }
+
+    // Returns one of kValues.
+    double value()
+    {
+        return kValues[random_() % (sizeof(kValues) / sizeof(kValues[0]))];
+    }
+
+private:
+    std::mt19937 random_;
+};
+
+} // namespace calc::test
+
+#endif // TEST_SUPPORT_H
@@ -0,0 +1,236 @@
+#include "thread_pool.h"
+
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// -------------------------------------------------------------------------------------------------
+
+uint64_t pack_range(uint32_t begin, uint32_t end)
+{
+    return static_cast<uint64_t>(end) << 32 | begin;
+}
+
+uint32_t range_begin(uint64_t bounds)
+{
+    return static_cast<uint32_t>(bounds);
+}
+
+uint32_t range_end(uint64_t bounds)
+{
+    return static_cast<uint32_t>(bounds >> 32);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// The task of a parallel loop running on this thread: its pool and the worker running it.
+struct RunningTask
+{
+    const calc::ThreadPool* pool;
+    size_t worker;
+};
+
+thread_local RunningTask running_task{nullptr, 0};
+
+} // anonymous namespace
+
+namespace calc {
+
+// -------------------------------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(size_t workers)
+{
+    if (workers == 0)
+        workers = std::thread::hardware_concurrency();
+    workers_ = workers == 0 ? 1 : workers;
+
+    ranges_ = std::make_unique<Range[]>(workers_);
+    threads_.reserve(workers_ - 1);
+    for (size_t worker = 1; worker < workers_; ++worker)
+        threads_.emplace_back([this, worker]() { worker_loop(worker); });
+}
+
+// -------------------------------------------------------------------------------------------------
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& thread : threads_)
+        thread.join();
+}
+
+// -------------------------------------------------------------------------------------------------
+
+size_t ThreadPool::size() const
+{
+    return workers_;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void ThreadPool::parallel_for(size_t count, const Task& task)
+{
+    if (count == 0)
+        return;
+    if (count > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Too many tasks in the parallel loop");
+
+    // The loop started by a task of this pool would wait for the loop running it forever, so it
+    // is run by the same worker right here.
+    if (running_task.pool == this)
+    {
+        run_inline(count, task, running_task.worker);
+        return;
+    }
+
+    std::lock_guard<std::mutex> loop_lock(loop_mutex_);
+
+    // Split indices evenly, the first workers get one index more if it is not divisible.
+    const size_t part = count / workers_;
+    const size_t rest = count % workers_;
+    size_t begin = 0;
+    for (size_t worker = 0; worker < workers_; ++worker)
+    {
+        const size_t end = begin + part + (worker < rest ? 1 : 0);
+        ranges_[worker].bounds.store(pack_range(static_cast<uint32_t>(begin),
+                                                static_cast<uint32_t>(end)));
+        begin = end;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        error_ = nullptr;
+        busy_ = threads_.size();
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    run(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return busy_ == 0; });
+        task_ = nullptr;
+        error = error_;
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void ThreadPool::worker_loop(size_t worker)
+{
+    uint64_t generation = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this, generation]() { return stop_ || generation_ != generation; });
+            if (stop_)
+                return;
+            generation = generation_;
+        }
+
+        run(worker);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_ == 0)
+            done_.notify_one();
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void ThreadPool::run(size_t worker)
+{
+    const RunningTask outer = running_task;
+    running_task = {this, worker};
+
+    size_t index = 0;
+    while (pop(worker, index) || steal(worker, index))
+    {
+        try {
+            (*task_)(index, worker);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+        }
+    }
+
+    running_task = outer;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+void ThreadPool::run_inline(size_t count, const Task& task, size_t worker)
+{
+    std::exception_ptr error;
+    for (size_t index = 0; index < count; ++index)
+    {
+        try {
+            task(index, worker);
+        }
+        catch (...) {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool ThreadPool::pop(size_t worker, size_t& index)
+{
+    std::atomic<uint64_t>& bounds = ranges_[worker].bounds;
+    uint64_t current = bounds.load();
+    while (range_begin(current) < range_end(current))
+    {
+        const uint64_t next = pack_range(range_begin(current) + 1, range_end(current));
+        if (bounds.compare_exchange_weak(current, next))
+        {
+            index = range_begin(current);
+            return true;
+        }
+    }
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+bool ThreadPool::steal(size_t worker, size_t& index)
+{
+    for (size_t offset = 1; offset < workers_; ++offset)
+    {
+        std::atomic<uint64_t>& victim = ranges_[(worker + offset) % workers_].bounds;
+        uint64_t current = victim.load();
+        while (range_begin(current) < range_end(current))
+        {
+            // Take the back half of the victim range, the first stolen index is run at once and
+            // the rest becomes the own range, so other workers can steal it again.
+            const uint32_t begin = range_begin(current);
+            const uint32_t end = range_end(current);
+            const uint32_t middle = end - (end - begin + 1) / 2;
+            if (victim.compare_exchange_weak(current, pack_range(begin, middle)))
+            {
+                ranges_[worker].bounds.store(pack_range(middle + 1, end));
+                index = middle;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace calc
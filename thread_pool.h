@@ -0,0 +1,87 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace calc {
+
+// Pool of worker threads running index-based parallel loops.
+//
+// Every parallel loop splits its index range evenly between the workers. A worker takes indices
+// from the front of its own range and, when the range is empty, steals the back half of the range
+// of another worker. So loops with uneven work per index still keep all workers busy.
+class ThreadPool
+{
+public:
+    // Task of a parallel loop. 'index' is the loop index, 'worker' is the index of the worker
+    // running the task, it is less than size() and can be used to select per-worker data.
+    using Task = std::function<void(size_t index, size_t worker)>;
+
+    // Creates the pool of the given number of workers including the calling thread, zero means
+    // the number of hardware threads.
+    explicit ThreadPool(size_t workers = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Returns the number of workers including the calling thread.
+    size_t size() const;
+
+    // Runs task(index, worker) for every index in [0, count) and returns when all tasks are done.
+    // The calling thread works as the worker 0. The first exception thrown by a task is rethrown
+    // here after all tasks are done. Loops of different callers are run one by one. The loop
+    // started by a task of this pool, e.g. evaluate_batch() inside evaluate_lines(), is run by the
+    // worker of that task alone, with its worker index.
+    void parallel_for(size_t count, const Task& task);
+
+private:
+    // Range of loop indices owned by a worker, its begin is kept in the low half of the value and
+    // its end - in the high one, so the owner and thieves change it with a single CAS.
+    struct alignas(64) Range
+    {
+        std::atomic<uint64_t> bounds{0};
+    };
+
+    void worker_loop(size_t worker);
+
+    // Runs tasks of the current loop until there is nothing to take or to steal.
+    void run(size_t worker);
+
+    // Runs all tasks of the nested loop by the worker.
+    static void run_inline(size_t count, const Task& task, size_t worker);
+
+    // These functions take one index from the own range or steal a part of another range.
+    bool pop(size_t worker, size_t& index);
+    bool steal(size_t worker, size_t& index);
+
+    std::vector<std::thread> threads_;
+    std::unique_ptr<Range[]> ranges_;
+    size_t workers_{1};
+
+    // Serializes parallel loops of different callers.
+    std::mutex loop_mutex_;
+
+    // Guards the state of the current loop below.
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const Task* task_{nullptr};
+    std::exception_ptr error_;
+    uint64_t generation_{0};
+    size_t busy_{0};
+    bool stop_{false};
+};
+
+} // namespace calc
+
+#endif // THREAD_POOL_H
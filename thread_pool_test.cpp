@@ -0,0 +1,165 @@
+#include "batch.h"
+#include "equation.h"
+#include "test_support.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Checks of the parallel loops of the thread pool and of the parallel batch evaluation, which must
+// give exactly the results of the single threaded one.
+
+using namespace calc::test;
+
+namespace {
+
+// -------------------------------------------------------------------------------------------------
+
+// Every index is run once by a valid worker, also when the work per index is uneven.
+void check_indices(calc::ThreadPool& pool)
+{
+    for (size_t count : {size_t{0}, size_t{1}, size_t{3}, size_t{1000}, size_t{100000}})
+    {
+        const auto runs = std::make_unique<std::atomic<int>[]>(count);
+        std::atomic<bool> bad_worker{false};
+        pool.parallel_for(count, [&](size_t index, size_t worker)
+        {
+            if (worker >= pool.size())
+                bad_worker = true;
+            if (index % 97 == 0)
+                std::this_thread::yield();
+            ++runs[index];
+        });
+
+        size_t wrong = 0;
+        for (size_t index = 0; index < count; ++index)
+            wrong += runs[index] != 1;
+        check(wrong == 0 && !bad_worker,
+              std::to_string(wrong) + " of " + std::to_string(count) + " indices are not run once");
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// The first exception is rethrown after all tasks are done, the pool still works then.
+void check_exceptions(calc::ThreadPool& pool)
+{
+    std::atomic<size_t> done{0};
+    bool thrown = false;
+    try {
+        pool.parallel_for(100, [&](size_t index, size_t)
+        {
+            ++done;
+            if (index % 10 == 0)
+                throw std::runtime_error("task failed");
+        });
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    check(thrown && done == 100, "the exception of the task is lost or stops the loop");
+
+    done = 0;
+    pool.parallel_for(100, [&](size_t, size_t) { ++done; });
+    check(done == 100, "the pool does not work after the exception");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// The loop started by a task of the same pool must not wait for the loop running the task, it is
+// run by the worker of that task.
+void check_nested_loops(calc::ThreadPool& pool)
+{
+    std::atomic<size_t> tasks{0};
+    std::atomic<bool> other_worker{false};
+    pool.parallel_for(8, [&](size_t, size_t worker)
+    {
+        pool.parallel_for(8, [&](size_t, size_t nested_worker)
+        {
+            if (nested_worker != worker)
+                other_worker = true;
+            ++tasks;
+        });
+    });
+    check(tasks == 64 && !other_worker,
+          "nested loops run " + std::to_string(tasks.load()) + " tasks instead of 64");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Loops of different callers are run one by one.
+void check_concurrent_callers(calc::ThreadPool& pool)
+{
+    std::atomic<size_t> tasks{0};
+    auto caller = [&]()
+    {
+        for (int loop = 0; loop < 50; ++loop)
+            pool.parallel_for(100, [&](size_t, size_t) { ++tasks; });
+    };
+    std::thread first(caller);
+    std::thread second(caller);
+    first.join();
+    second.join();
+    check(tasks == 10000, "concurrent loops run " + std::to_string(tasks.load()) + " tasks");
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// Many chunks of rows with failures in several of them, the first failed row is the least one.
+void check_parallel_batch(calc::ThreadPool& pool)
+{
+    constexpr size_t kRows = 100000;
+
+    const std::vector<std::string> variables = {"a", "b", "c"};
+    const calc::CompiledExpression expression =
+        calc::compile("(a * b - c) / (b - 1) + sqrt(a) ^ 3", variables);
+
+    ExpressionGenerator generate(5);
+    std::vector<double> values(3 * kRows);
+    for (double& value : values)
+        value = generate.value();
+    const double* const columns[] = {&values[0], &values[kRows], &values[2 * kRows]};
+
+    std::vector<double> serial(kRows);
+    std::vector<double> parallel(kRows);
+    const calc::BatchResult expected =
+        calc::evaluate_batch(expression, columns, 3, kRows, serial.data());
+    const calc::BatchResult batch =
+        calc::evaluate_batch(expression, columns, 3, kRows, parallel.data(), pool);
+
+    size_t different = 0;
+    for (size_t row = 0; row < kRows; ++row)
+        different += !same_value(serial[row], parallel[row]);
+    check(different == 0, std::to_string(different) + " rows differ in the parallel batch");
+    check(!expected.ok && batch.ok == expected.ok && batch.failed_rows == expected.failed_rows
+          && batch.first_failed_row == expected.first_failed_row && batch.error == expected.error,
+          "the parallel batch reports " + std::to_string(batch.failed_rows) + " failed rows from "
+          + std::to_string(batch.first_failed_row) + " instead of "
+          + std::to_string(expected.failed_rows) + " from "
+          + std::to_string(expected.first_failed_row));
+}
+
+} // anonymous namespace
+
+// -------------------------------------------------------------------------------------------------
+
+int main()
+{
+    calc::ThreadPool pool(4);
+    check(pool.size() == 4, "the pool has " + std::to_string(pool.size()) + " workers");
+
+    check_indices(pool);
+    check_exceptions(pool);
+    check_nested_loops(pool);
+    check_concurrent_callers(pool);
+    check_parallel_batch(pool);
+
+    calc::ThreadPool single(1);
+    check_indices(single);
+    check_nested_loops(single);
+    return finish();
+}
@@ -69,8 +69,10 @@ void Widget::calculate()
 
     ui->errorField->clear();
 
-    calc::Result res = calc::calculate(m_equation.toLatin1());
-    if (res.ok) {
+    const QByteArray equation = m_equation.toLatin1();
+    const std::string_view text(equation.constData(), equation.size());
+    calc::Result res = calc::calculate(text);
+    if (res.ok()) {
         QString res_str = QString::number(res.result);
         m_equation.clear();
 
@@ -78,6 +80,7 @@ void Widget::calculate()
         updateEquation(res_str);
 
     } else {
-        ui->errorField->setText(res.what.c_str());
+        const std::string what = calc::describe_error(res.error, res.position, text);
+        ui->errorField->setText(what.c_str());
     }
 }